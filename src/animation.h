@@ -4,6 +4,12 @@
 #include "utils.h"
 #include "format.h"
 
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#define MAX_POSE_JOINTS 64
+
 struct Animation {
     TR::Level       *level;
     const TR::Model *model;
@@ -14,16 +20,18 @@ struct Animation {
     int             frameIndex, framePrev, framesCount;
 
     TR::AnimFrame   *frameA, *frameB;
+    const float     *rotA, *rotB;   // decoded joint rotations of the frames (see TR::Level::initAnimFrames)
+    int             strideA, strideB, rotJoints;
     vec3            offset, jump;
     bool            isEnded, isPrepareToNext, flip;
 
     quat            *overrides;   // left & right arms animation frames
     int             overrideMask;
 
-    Animation() : overrides(NULL) {}
+    Animation() : rotJoints(0), overrides(NULL) {}
 
     Animation(TR::Level *level, const TR::Model *model) : level(level), model(model), anims(model ? &level->anims[model->animation] : NULL), time(0), delta(0), dir(1.0f),
-                                                          index(-1), prev(0), next(0), overrides(NULL), overrideMask(0) {
+                                                          index(-1), prev(0), next(0), rotJoints(0), overrides(NULL), overrideMask(0) {
         if (anims) setAnim(0);
     }
 
@@ -79,6 +87,31 @@ struct Animation {
         return (TR::AnimFrame*)&level->frameData[anim->frameOffset / 2 + index * frameSize]; // >> 1 (div 2) because frameData is array of shorts
     }
 
+    const float* getFrameRot(TR::Animation *anim, int index, int &stride, int &joints) {
+        const TR::AnimFrames &af = level->animFrames[anim - level->anims];
+    // TR1 frames have no fixed size, the rows are decoded with the joints count of the owner model
+    // so the model that plays a shared animation with another joints count reads the frame stream
+        if (index < 0 || index >= af.count || (!anim->frameSize && af.joints != model->mCount)) {
+            joints = 0;
+            return NULL;
+        }
+        stride = af.stride;
+        joints = min(joints, int(af.joints));
+        return level->framesRot + af.rot + index * af.stride * 4;
+    }
+
+    // use the pose of another animation
+    void setFrames(const Animation &anim) {
+        frameA    = anim.frameA;
+        frameB    = anim.frameB;
+        rotA      = anim.rotA;
+        rotB      = anim.rotB;
+        strideA   = anim.strideA;
+        strideB   = anim.strideB;
+        rotJoints = anim.rotJoints;
+        delta     = anim.delta;
+    }
+
     void updateInfo() {
         ASSERT(model);
         ASSERT(anims);
@@ -99,6 +132,8 @@ struct Animation {
             fIndexB = (fIndex + 1) % fCount;
 
         frameA = getFrame(anim, fIndexA);
+        rotJoints = model->mCount;
+        rotA = getFrameRot(anim, fIndexA, strideA, rotJoints);
  
         int frameNext = frameIndex + 1;
         isPrepareToNext = !fIndexB;
@@ -112,6 +147,7 @@ struct Animation {
         getCommand(anim, frameNext, NULL, NULL, &flip);
 
         frameB = getFrame(anim, fIndexB);
+        rotB = getFrameRot(anim, fIndexB, strideB, rotJoints);
     }
 
     bool isFrameActive(int index) {
@@ -178,46 +214,110 @@ struct Animation {
     }
 
     void getCommand(TR::Animation *anim, int frameIndex, vec3 *offset, vec3 *jump, bool *flip) {
-        int16 *ptr = &level->commands[anim->animCommand];
-
-        if (offset) *offset = vec3(0.0f);
-        if (flip)   *flip   = false;
-
-        for (int i = 0; i < anim->acCount; i++) {
-            int cmd = *ptr++; 
-            switch (cmd) {
-                case TR::ANIM_CMD_OFFSET :
-                    if (offset) {
-                        offset->x = (float)*ptr++;
-                        offset->y = (float)*ptr++;
-                        offset->z = (float)*ptr++;
-                    } else
-                        ptr += 3;
-                    break;
-                case TR::ANIM_CMD_JUMP :
-                    if (jump) {
-                        jump->y = (float)*ptr++;
-                        jump->z = (float)*ptr++;
-                    } else
-                        ptr += 2;
-                    break;                
-                case TR::ANIM_CMD_SOUND  : ptr += 2; break;
-                case TR::ANIM_CMD_EFFECT :
-                    if (flip) {
-                        int frame = (*ptr++) - anim->frameStart;
-                        int fx    = (*ptr++) & 0x3FFF;
-                        *flip     = fx == TR::Effect::ROTATE_180 && frame == frameIndex;
-                    } else
-                        ptr += 2;
-                    break;
-            }
+        const TR::AnimCommands &ac = level->animCommands[anim - level->anims];
+
+        if (offset) *offset = ac.offset;
+        if (jump && ac.hasJump) {
+            jump->y = ac.jump.y;
+            jump->z = ac.jump.z;
         }
+        if (flip) *flip = ac.hasFlip && ac.flipFrame == frameIndex;
     }
 
     quat getJointRot(int joint) {
+        if (joint < rotJoints) {
+            quat a(rotA[joint], rotA[joint + strideA], rotA[joint + strideA * 2], rotA[joint + strideA * 3]);
+            quat b(rotB[joint], rotB[joint + strideB], rotB[joint + strideB * 2], rotB[joint + strideB * 3]);
+            return a.lerp(b, delta);
+        }
         return lerpAngle(frameA->getAngle(level->version, joint), frameB->getAngle(level->version, joint), delta);
     }
 
+    // local rotations of all joints, 4 joints at a time from the decoded frame tables
+    void getJointRots(quat *rots) {
+        int count = model->mCount;
+        int i = 0;
+
+    #ifdef __SSE2__
+        if (delta > 0.0f && delta < 1.0f) {
+            const __m128 t    = _mm_set1_ps(delta);
+            const __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+            for (; i + 4 <= rotJoints; i += 4) {
+                __m128 ax = _mm_load_ps(rotA + i);
+                __m128 ay = _mm_load_ps(rotA + i + strideA);
+                __m128 az = _mm_load_ps(rotA + i + strideA * 2);
+                __m128 aw = _mm_load_ps(rotA + i + strideA * 3);
+                __m128 bx = _mm_load_ps(rotB + i);
+                __m128 by = _mm_load_ps(rotB + i + strideB);
+                __m128 bz = _mm_load_ps(rotB + i + strideB * 2);
+                __m128 bw = _mm_load_ps(rotB + i + strideB * 3);
+
+            // same as quat::lerp: negate b if the dot product is negative
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz)), _mm_mul_ps(aw, bw));
+                __m128 s = _mm_and_ps(_mm_cmplt_ps(d, _mm_setzero_ps()), sign);
+
+                ax = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(bx, s), ax), t));
+                ay = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(by, s), ay), t));
+                az = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(bz, s), az), t));
+                aw = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(bw, s), aw), t));
+
+                _MM_TRANSPOSE4_PS(ax, ay, az, aw);
+                _mm_storeu_ps((float*)&rots[i + 0], ax);
+                _mm_storeu_ps((float*)&rots[i + 1], ay);
+                _mm_storeu_ps((float*)&rots[i + 2], az);
+                _mm_storeu_ps((float*)&rots[i + 3], aw);
+            }
+        }
+    #endif
+
+        for (; i < count; i++)
+            rots[i] = getJointRot(i);
+
+        if (overrideMask)
+            for (i = 0; i < count; i++)
+                if (overrideMask & (1 << i))
+                    rots[i] = overrides[i];
+    }
+
+    // all joints of the pose, the hierarchy is concatenated in quaternions instead of matrices (see Controller::updateJoints)
+    void getPose(const mat4 &matrix, Basis *joints) {
+        ASSERT(model);
+        if (model->mCount > MAX_POSE_JOINTS) {
+            getJoints(matrix, -1, true, joints);
+            return;
+        }
+
+        quat rots[MAX_POSE_JOINTS];
+        getJointRots(rots);
+
+        Basis basis(matrix);
+        vec3 offset = isPrepareToNext ? this->offset : vec3(0.0f);
+        basis.translate(((vec3)frameA->pos).lerp(offset + frameB->pos, delta));
+
+        TR::Node *node = (int)model->node < level->nodesDataSize ? (TR::Node*)&level->nodesData[model->node] : NULL;
+
+        int sIndex = 0;
+        Basis stack[16];
+
+        for (int i = 0; i < model->mCount; i++) {
+
+            if (i > 0 && node) {
+                TR::Node &t = node[i - 1];
+
+                if (t.flags & 0x01) basis = stack[--sIndex];
+                if (t.flags & 0x02) stack[sIndex++] = basis;
+
+                ASSERT(sIndex >= 0 && sIndex < int(COUNT(stack)));
+
+                basis.translate(vec3((float)t.x, (float)t.y, (float)t.z));
+            }
+
+            basis.rot = (basis.rot * rots[i]).normal();
+            joints[i] = basis;
+        }
+    }
+
     Basis getJoints(const mat4 &matrix, int joint, bool postRot = false, Basis *joints = NULL) {
         mat4 basis = matrix;
 
@@ -224,6 +224,10 @@ struct ShaderCache {
 
 };
 
+#define AMBIENT_MAX_TASKS   32
+#define AMBIENT_READ_FRAMES 3   // readback buffers in flight
+#define AMBIENT_READ_WAIT   4   // frames to wait for the readback without fence before fetching anyway
+
 struct AmbientCache {
     IGame     *game;
     TR::Level *level;
@@ -241,9 +245,16 @@ struct AmbientCache {
         int  flip;
         int  sector;
         Cube *cube;
-    } tasks[32];
+    } tasks[AMBIENT_MAX_TASKS];
     int tasksCount;
 
+    struct Readback {
+        Core::PixelBuffer *buffer; // 6 faces per cube
+        Cube *cubes[AMBIENT_MAX_TASKS];
+        int  count;
+        int  frames;
+    } reads[AMBIENT_READ_FRAMES];
+
     Texture *textures[6 * 4]; // 64, 16, 4, 1 
 
     AmbientCache(IGame *game) : game(game), level(game->getLevel()), tasksCount(0) {
@@ -262,6 +273,12 @@ struct AmbientCache {
         for (int j = 0; j < 6; j++)
             for (int i = 0; i < 4; i++)
                 textures[j * 4 + i] = new Texture(64 >> (i << 1), 64 >> (i << 1), Texture::RGBA, false);
+    // init readback buffers
+        for (int i = 0; i < AMBIENT_READ_FRAMES; i++) {
+            reads[i].buffer = new Core::PixelBuffer(AMBIENT_MAX_TASKS * 6);
+            reads[i].count  = 0;
+            reads[i].frames = 0;
+        }
     }
 
     ~AmbientCache() {
@@ -269,10 +286,12 @@ struct AmbientCache {
         delete[] offsets;
         for (int i = 0; i < 6 * 4; i++)
             delete textures[i];
+        for (int i = 0; i < AMBIENT_READ_FRAMES; i++)
+            delete reads[i].buffer;
     }
 
     void addTask(int room, int sector) {
-        if (tasksCount >= 32) return;
+        if (tasksCount >= AMBIENT_MAX_TASKS) return;
 
         Task &task  = tasks[tasksCount++];
         task.room   = room;
@@ -282,7 +301,7 @@ struct AmbientCache {
         task.cube->status = Cube::WAIT;
     }
 
-    void renderAmbient(int room, int sector, vec3 *colors) {
+    void renderAmbient(int room, int sector, Core::PixelBuffer *buffer, int index) {
         PROFILE_MARKER("PASS_AMBIENT");
                 
         TR::Room &r = level->rooms[room];
@@ -314,28 +333,68 @@ struct AmbientCache {
             }
         }
 
-        // get result color from 1x1 textures
+        // read result color from 1x1 textures (see fetchQueue)
         for (int j = 0; j < 6; j++) {
             Core::setTarget(textures[j * 4 + 3]);
-            colors[j] = Core::copyPixel(0, 0).xyz();
+            buffer->read(index * 6 + j, 0, 0);
         }
 
         Core::setDepthTest(true);
     }
 
+    // get colors of the finished readbacks
+    void fetchQueue() {
+        for (int i = 0; i < AMBIENT_READ_FRAMES; i++) {
+            Readback &rb = reads[i];
+            if (!rb.count || !rb.buffer->fetch(rb.frames >= AMBIENT_READ_WAIT))
+                continue;
+
+            for (int j = 0; j < rb.count; j++) {
+                Cube *cube = rb.cubes[j];
+                for (int k = 0; k < 6; k++) {
+                    const ubyte4 &c = rb.buffer->data[j * 6 + k];
+                    cube->colors[k] = vec3(float(c.x), float(c.y), float(c.z)) * (1.0f / 255.0f);
+                }
+                cube->status = Cube::READY;
+            }
+            rb.count = 0;
+        }
+    }
+
     void processQueue() {
+        for (int i = 0; i < AMBIENT_READ_FRAMES; i++)
+            if (reads[i].count)
+                reads[i].frames++;
+
+        fetchQueue();
+
+        if (!tasksCount) return;
+
+        Readback *rb = NULL;
+        for (int i = 0; i < AMBIENT_READ_FRAMES; i++)
+            if (!reads[i].count) {
+                rb = &reads[i];
+                break;
+            }
+        if (!rb) return; // all readbacks are in flight, keep the tasks for the next frame
+
         game->setupBinding();
         for (int i = 0; i < tasksCount; i++) {
             Task &task = tasks[i];
             
             bool oldFlip = level->state.flags.flipped;
             level->state.flags.flipped = task.flip != 0;
-            renderAmbient(task.room, task.sector, &task.cube->colors[0]);
+            renderAmbient(task.room, task.sector, rb->buffer, i);
             level->state.flags.flipped = oldFlip;
 
-            task.cube->status = Cube::READY;
+            rb->cubes[i] = task.cube;
         }
+        rb->buffer->submit();
+        rb->count  = tasksCount;
+        rb->frames = 0;
         tasksCount = 0;
+
+        fetchQueue(); // readback without pixel buffer is ready right away
     }
 
     Cube* getAmbient(int room, int sector) {
@@ -961,6 +1020,188 @@ struct ZoneCache {
     }
 };
 
+// soundtrack prefetch: opens decoders for tracks triggered in the current and adjacent rooms on a background thread
+#define MAX_PREFETCH_TRACKS 2
+
+struct TrackCache {
+    struct Item {
+        TrackCache      *cache;
+        Sound::Decoder  *decoder;
+        void            *done;    // signaled by the loading task
+        bool            loading;
+        int             track;
+        bool            ready;
+    } items[MAX_PREFETCH_TRACKS];
+
+    IGame   *game;
+    Mutex   lock;
+    int     roomIndex;
+    int     hits, misses;
+
+    TrackCache(IGame *game) : game(game), roomIndex(TR::NO_ROOM), hits(0), misses(0) {
+        for (int i = 0; i < MAX_PREFETCH_TRACKS; i++) {
+            Item &item = items[i];
+            item.cache   = this;
+            item.decoder = NULL;
+            item.done    = osEventInit();
+            item.loading = false;
+            item.track   = -1;
+            item.ready   = false;
+        }
+    }
+
+    ~TrackCache() {
+        for (int i = 0; i < MAX_PREFETCH_TRACKS; i++) {
+            free(items[i]);
+            osEventFree(items[i].done);
+        }
+        LOG("track prefetch: %d hits, %d misses\n", hits, misses);
+    }
+
+    static void loadCallback(Stream *stream, void *userData) {
+        Item *item = (Item*)userData;
+        Sound::Decoder *decoder = stream ? Sound::openDecoder(stream) : NULL;
+
+        OS_LOCK(item->cache->lock);
+        item->decoder = decoder;
+        item->ready   = true;
+    }
+
+    static void loadJob(void *userData, int, int) {
+        Item *item = (Item*)userData;
+        TR::getGameTrack(item->cache->game->getLevel()->version, item->track, loadCallback, item);
+        osEventSignal(item->done);
+    }
+
+    bool isReady(Item &item) {
+        OS_LOCK(lock);
+        return item.ready;
+    }
+
+    void wait(Item &item) {
+        if (item.loading) {
+            osEventWait(item.done);
+            item.loading = false;
+        }
+    }
+
+    void free(Item &item) {
+        wait(item);
+        delete item.decoder;
+        item.decoder = NULL;
+        item.track   = -1;
+        item.ready   = false;
+    }
+
+    void load(Item &item, int track) {
+        item.track   = track;
+        item.ready   = false;
+        item.loading = true;
+        jobPool.async(loadJob, &item);
+    }
+
+    Item* getItem(int track) {
+        for (int i = 0; i < MAX_PREFETCH_TRACKS; i++)
+            if (items[i].track == track)
+                return &items[i];
+        return NULL;
+    }
+
+    void addTrack(int track, int *tracks, int &count) {
+        TR::Level *level = game->getLevel();
+        if (count == MAX_PREFETCH_TRACKS || track == level->state.flags.track || level->state.tracks[track].once)
+            return;
+        for (int i = 0; i < count; i++)
+            if (tracks[i] == track)
+                return;
+        tracks[count++] = track;
+    }
+
+    void getRoomTracks(int roomIndex, int *tracks, int &count) {
+        TR::Level *level = game->getLevel();
+        TR::Room  &room  = level->rooms[roomIndex];
+
+        for (int i = 0; i < room.xSectors * room.zSectors; i++) {
+            if (!room.sectors[i].floorIndex)
+                continue;
+
+            TR::FloorData *fd = &level->floors[room.sectors[i].floorIndex];
+            TR::FloorData::Command cmd;
+            do {
+                cmd = (*fd++).cmd;
+                if (cmd.func == TR::FloorData::TRIGGER) {
+                    fd++; // trigger info
+                    TR::FloorData::TriggerCommand trigCmd;
+                    do {
+                        trigCmd = (*fd++).triggerCmd;
+                        if (trigCmd.action == TR::Action::SOUNDTRACK)
+                            addTrack(trigCmd.args, tracks, count);
+                        else if (trigCmd.action == TR::Action::CAMERA_SWITCH)
+                            trigCmd = (*fd++).triggerCmd; // skip camera params
+                    } while (!trigCmd.end);
+                } else
+                    level->floorSkipCommand(fd, cmd.func);
+            } while (!cmd.end);
+        }
+    }
+
+// called on room change, keeps decoders for the tracks triggered nearby
+    void update(int roomIndex) {
+        if (this->roomIndex == roomIndex || roomIndex == TR::NO_ROOM)
+            return;
+        this->roomIndex = roomIndex;
+
+        TR::Level *level = game->getLevel();
+        TR::Room  &room  = level->rooms[roomIndex];
+
+        int tracks[MAX_PREFETCH_TRACKS];
+        int count = 0;
+
+        getRoomTracks(roomIndex, tracks, count);
+        for (int i = 0; i < room.portalsCount && count < MAX_PREFETCH_TRACKS; i++)
+            getRoomTracks(room.portals[i].roomIndex, tracks, count);
+
+    // release unused (ready) items and start loading the new ones
+        for (int i = 0; i < count; i++) {
+            if (getItem(tracks[i]))
+                continue;
+
+            for (int j = 0; j < MAX_PREFETCH_TRACKS; j++) {
+                Item &item = items[j];
+                bool used = false;
+                for (int k = 0; k < count; k++)
+                    used |= item.track == tracks[k];
+
+                if (!used && (item.track == -1 || isReady(item))) {
+                    free(item);
+                    load(item, tracks[i]);
+                    break;
+                }
+            }
+        }
+    }
+
+// returns the primed decoder (waits for the loading) or NULL if the track wasn't predicted
+    Sound::Decoder* getDecoder(int track) {
+        Item *item = getItem(track);
+        if (!item) {
+            misses++;
+            return NULL;
+        }
+
+        wait(*item);
+        Sound::Decoder *decoder = item->decoder;
+        item->decoder = NULL;
+        free(*item);
+
+        if (decoder) // NULL if the track is missing
+            hits++;
+        else
+            misses++;
+        return decoder;
+    }
+};
+
 #undef UNDERWATER_COLOR
 
 #endif
@@ -22,9 +22,12 @@ struct Camera : ICamera {
     vec3        advAngle, targetAngle;
     float       advTimer;
     mat4        mViewInv;
-
     float       timer;
 
+    mat4        mViewTick;          // view of the last update without the head pose (see storeView)
+    Basis       viewPrev, viewNext; // views of the two last simulation ticks (see interpolateView)
+    int         viewTick;
+
     int         viewIndex;
     int         viewIndexLast;
     Controller* viewTarget;
@@ -32,7 +35,7 @@ struct Camera : ICamera {
     int         speed;
     bool        smooth;
 
-    Camera(IGame *game, Character *owner) : ICamera(), game(game), level(game->getLevel()), frustum(new Frustum()), timer(-1.0f), viewIndex(-1), viewIndexLast(-1), viewTarget(NULL) {
+    Camera(IGame *game, Character *owner) : ICamera(), game(game), level(game->getLevel()), frustum(new Frustum()), timer(-1.0f), viewTick(-1), viewIndex(-1), viewIndexLast(-1), viewTarget(NULL) {
         this->owner = owner;
         changeView(false);
         if (level->isCutsceneLevel()) {
@@ -486,7 +489,8 @@ struct Camera : ICamera {
             } else
                 updateFirstPerson();
 
-            mViewInv = mat4(eye.pos, target.pos, vec3(0, -1, 0));
+            mViewInv  = mat4(eye.pos, target.pos, vec3(0, -1, 0));
+            mViewTick = mViewInv;
 
             checkRoom();
         } else {
@@ -594,15 +598,36 @@ struct Camera : ICamera {
             } else
                 updateFirstPerson();
 
-            if (Core::settings.detail.vr) {
-                mViewInv = mViewInv * Input::hmd.eye[0];
-            }
+            mViewTick = mViewInv;
+            applyHead();
         }
         updateListener();
         
         smooth = true;
     }
 
+    void applyHead() {
+        if (Core::settings.detail.vr && mode != MODE_CUTSCENE)
+            mViewInv = mViewInv * Input::hmd.eye[0];
+    }
+
+// the head pose is not stored, it is applied to every rendered frame with the latest HMD state
+    void storeView(int tick) {
+        viewPrev = (viewTick == tick - 1) ? viewNext : Basis(mViewTick);
+        viewNext = Basis(mViewTick);
+        viewTick = tick;
+    }
+
+// view for rendering between the two last simulation ticks, camera cuts are not interpolated
+    void interpolateView(int tick, float t) {
+        if (viewTick != tick)
+            return;
+        if ((viewNext.pos - viewPrev.pos).length2() > TICK_SNAP_DIST * TICK_SNAP_DIST)
+            t = 1.0f;
+        mViewInv = mat4(viewPrev.rot.lerp(viewNext.rot, t).normal(), viewPrev.pos.lerp(viewNext.pos, t));
+        applyHead();
+    }
+
     virtual void setup(bool calcMatrices) {
         if (calcMatrices) {
             Core::mViewInv = mViewInv;
@@ -14,6 +14,8 @@
 
 #define UNLIMITED_AMMO  10000
 
+#define TICK_SNAP_DIST  512.0f // longer moves between two simulation ticks are teleports and not interpolated
+
 struct Controller;
 
 struct ICamera {
@@ -62,6 +64,7 @@ struct IGame {
     virtual Controller*  getLara(int index = 0)   { return NULL; }
     virtual Controller*  getLara(const vec3 &pos) { return NULL; }
     virtual bool         isCutscene()   { return false; }
+    virtual int          getTickIndex() { return 0; }
     virtual uint16       getRandomBox(uint16 zone, uint16 *zones) { return 0; }
     virtual uint16       findPath(int ascend, int descend, bool big, int boxStart, int boxEnd, uint16 *zones, uint16 **boxes) { return 0; }
     virtual void setClipParams(float clipSign, float clipHeight) {}
@@ -80,6 +83,8 @@ struct IGame {
 
     virtual Controller* addEntity(TR::Entity::Type type, int room, const vec3 &pos, float angle = 0.0f) { return NULL; }
     virtual void removeEntity(Controller *controller) {}
+    virtual int  getRoomEntity(int)     { return -1; }
+    virtual int  getNextRoomEntity(int) { return -1; }
 
     virtual bool invUse(int playerIndex, TR::Entity::Type type) { return false; }
     virtual void invAdd(TR::Entity::Type type, int count = 1) {}
@@ -111,6 +116,10 @@ struct Controller {
 
     Basis   *joints;
     int     jointsFrame;
+    int     ambientFrame;
+    Basis   *jointsPrev, *jointsNext; // poses of the two last simulation ticks (see interpolateJoints)
+    int     jointsTick;               // tick of jointsNext
+    int     drawIndex;                // last rendered frame that queued the model (see Level::updatePoses)
 
     vec3    ambient[6];
     float   specular;
@@ -149,6 +158,11 @@ struct Controller {
         const TR::Model *m = getModel();
         joints      = m ? new Basis[m->mCount] : NULL;
         jointsFrame = -1;
+        ambientFrame = -1;
+        jointsPrev  = m ? new Basis[m->mCount] : NULL;
+        jointsNext  = m ? new Basis[m->mCount] : NULL;
+        jointsTick  = -1;
+        drawIndex   = -1;
 
         if (level->isCutsceneLevel())
             fixRoomIndex();
@@ -178,6 +192,8 @@ struct Controller {
 
     virtual ~Controller() {
         delete[] joints;
+        delete[] jointsPrev;
+        delete[] jointsNext;
         delete[] layers;
         delete[] explodeParts;
         deactivate(true);
@@ -849,6 +865,23 @@ struct Controller {
         }
     }
 
+    void cmdEvent(int type, int16 value) {
+        int fx = value & 0x3FFF;
+        if (type == TR::ANIM_CMD_EFFECT) {
+            switch (fx) {
+                case TR::Effect::ROTATE_180   : angle.y = angle.y + PI; break;
+                case TR::Effect::FLOOR_SHAKE  : game->setEffect(this, TR::Effect::Type(fx)); break;
+                case TR::Effect::FINISH_LEVEL : game->loadNextLevel(); break;
+                case TR::Effect::FLIP_MAP     : level->state.flags.flipped = !level->state.flags.flipped; break;
+                default                       : cmdEffect(fx); break;
+            }
+        } else {
+            if (!(value & 0x8000)) { // TODO 0x4000 / 0x8000 for ground / water foot steps
+                game->playSound(fx, pos, Sound::PAN);
+            }
+        }
+    }
+
     virtual void updateAnimation(bool commands) {
         animation.update();
 
@@ -864,41 +897,46 @@ struct Controller {
 
     // apply animation commands
         if (commands) {
-            int16 *ptr = &level->commands[anim->animCommand];
-
-            for (int i = 0; i < anim->acCount; i++) {
-                int cmd = *ptr++; 
-                switch (cmd) {
-                    case TR::ANIM_CMD_OFFSET : ptr += 3;   break;
-                    case TR::ANIM_CMD_JUMP   : ptr += 2;   break;      
-                    case TR::ANIM_CMD_EMPTY  : cmdEmpty(); break;
-                    case TR::ANIM_CMD_KILL   : 
-                        if (animation.isEnded)
-                            deactivate();
-                        break;
-                    case TR::ANIM_CMD_SOUND  :
-                    case TR::ANIM_CMD_EFFECT : {
-                        int frame = (*ptr++) - anim->frameStart;
-                        int16 sfx = (*ptr++);
-                        int fx    = sfx & 0x3FFF;
-                        if (animation.isFrameActive(frame)) {
-                            if (cmd == TR::ANIM_CMD_EFFECT) {
-                                switch (fx) {
-                                    case TR::Effect::ROTATE_180   : angle.y = angle.y + PI; break;
-                                    case TR::Effect::FLOOR_SHAKE  : game->setEffect(this, TR::Effect::Type(fx)); break;
-                                    case TR::Effect::FINISH_LEVEL : game->loadNextLevel(); break;
-                                    case TR::Effect::FLIP_MAP     : level->state.flags.flipped = !level->state.flags.flipped; break;
-                                    default                       : cmdEffect(fx); break;
-                                }
-                            } else {
-                                if (!(sfx & 0x8000)) { // TODO 0x4000 / 0x8000 for ground / water foot steps
-                                    game->playSound(fx, pos, Sound::PAN);
-                                }
-                            }
+            const TR::AnimCommands &ac = level->animCommands[anim - level->anims];
+
+            if (ac.ordered) { // walk the command stream to keep EMPTY and KILL after the preceding events
+                int16 *ptr = &level->commands[anim->animCommand];
+
+                for (int i = 0; i < anim->acCount; i++) {
+                    int cmd = *ptr++;
+                    switch (cmd) {
+                        case TR::ANIM_CMD_OFFSET : ptr += 3;   break;
+                        case TR::ANIM_CMD_JUMP   : ptr += 2;   break;
+                        case TR::ANIM_CMD_EMPTY  : cmdEmpty(); break;
+                        case TR::ANIM_CMD_KILL   :
+                            if (animation.isEnded)
+                                deactivate();
+                            break;
+                        case TR::ANIM_CMD_SOUND  :
+                        case TR::ANIM_CMD_EFFECT : {
+                            int frame = ptr[0] - anim->frameStart;
+                            if (frame >= 0 && frame < ac.frames && animation.isFrameActive(frame))
+                                cmdEvent(cmd, ptr[1]);
+                            ptr += 2;
+                            break;
                         }
-                        break;
                     }
                 }
+            } else {
+                for (int i = 0; i < ac.empty; i++)
+                    cmdEmpty();
+
+                if (ac.kill && animation.isEnded)
+                    deactivate();
+
+            // events of the frames passed since the last update
+                int from = max(animation.framePrev + 1, 0);
+                int to   = min(animation.frameIndex, ac.frames - 1);
+                if (ac.events != -1 && from <= to) {
+                    const int32 *first = level->animEventFrames + ac.events;
+                    for (int i = first[from]; i < first[to + 1]; i++)
+                        cmdEvent(level->animEvents[i].type, level->animEvents[i].value);
+                }
             }
         }
 
@@ -966,6 +1004,21 @@ struct Controller {
         }
     }
 
+// read phase of the tick, runs by jobs for all the active controllers before the first update() (see Level::updateControllers)
+// may only read the level and the other controllers, results go to the own state consumed by update()
+    virtual void prepare() {}
+
+#ifdef _DEBUG
+// the state gathered by prepare() still matches the world after the apply phase (see Level::checkPrepare)
+    virtual bool checkPrepare() { return true; }
+#endif
+
+    static void prepareJob(void *userData, int start, int end) {
+        Controller **list = (Controller**)userData;
+        for (int i = start; i < end; i++)
+            list[i]->prepare();
+    }
+
     virtual void update() {
         updateAnimation(true);
         updateExplosion();
@@ -1115,7 +1168,49 @@ struct Controller {
     void updateJoints() {
         if (Core::stats.frame == jointsFrame)
             return;
-        animation.getJoints(getMatrix(), -1, true, joints);
+        animation.getPose(getMatrix(), joints);
+        jointsFrame = Core::stats.frame;
+    }
+
+// evaluate poses of the controllers in one pass (see Level::updatePoses)
+    static void updateJoints(Controller **list, int count) {
+        for (int i = 0; i < count; i++) {
+            Controller *c = list[i];
+            c->animation.getPose(c->getMatrix(), c->joints);
+            c->jointsFrame = Core::stats.frame;
+        }
+    }
+
+// job of the parallel pose phase, userData is the list of controllers (see Level::updateControllers)
+    static void updateJointsJob(void *userData, int start, int end) {
+        updateJoints((Controller**)userData + start, end - start);
+    }
+
+// keep the pose of the simulation tick, the previous one is kept if it was posed by the previous tick
+    void storeJoints(int tick) {
+        int count = getModel()->mCount;
+        if (jointsTick == tick - 1)
+            swap(jointsPrev, jointsNext);
+        else
+            memcpy(jointsPrev, joints, count * sizeof(Basis));
+        memcpy(jointsNext, joints, count * sizeof(Basis));
+        jointsTick = tick;
+    }
+
+// pose for rendering between the two last simulation ticks (t = 0..1), models not posed by the last tick are rendered as is
+    void interpolateJoints(int tick, float t) {
+        if (jointsTick != tick)
+            return;
+
+        int count = getModel()->mCount;
+        if ((jointsNext[0].pos - jointsPrev[0].pos).length2() > TICK_SNAP_DIST * TICK_SNAP_DIST)
+            t = 1.0f;
+
+        for (int i = 0; i < count; i++) {
+            Basis &a = jointsPrev[i];
+            Basis &b = jointsNext[i];
+            joints[i] = Basis(a.rot.lerp(b.rot, t).normal(), a.pos.lerp(b.pos, t));
+        }
         jointsFrame = Core::stats.frame;
     }
 
@@ -1124,6 +1219,40 @@ struct Controller {
         return joints[index];
     }
 
+// state that affects the shadow map of the model (see Level::renderShadows)
+    virtual uint32 getShadowHash(uint32 hash) {
+        const TR::Model *model = getModel();
+        if (!model) return hash;
+
+        updateJoints();
+        hash = fnv32((const char*)joints, sizeof(Basis) * model->mCount, hash);
+        hash = fnv32((const char*)&visibleMask, sizeof(visibleMask), hash);
+        hash = fnv32((const char*)&explodeMask, sizeof(explodeMask), hash);
+        uint32 invisible = flags.invisible;
+        hash = fnv32((const char*)&invisible, sizeof(invisible), hash);
+        if (layers)
+            hash = fnv32((const char*)layers, sizeof(MeshLayer) * MAX_LAYERS, hash);
+        if (explodeMask)
+            for (int i = 0; i < model->mCount; i++)
+                hash = fnv32((const char*)&explodeParts[i].basis, sizeof(Basis), hash);
+        return hash;
+    }
+
+// instanced rendering of the model (see Level::renderEntityInstances), controllers with custom render should return false
+    virtual bool canInstance() const {
+        return !layers && !explodeMask;
+    }
+
+    bool prepareInstance(Frustum *frustum) {
+        Box box = animation.getBoundingBox(vec3(0, 0, 0), 0);
+        if (frustum && !frustum->isVisible(getMatrix(), box.min, box.max))
+            return false;
+
+        flags.rendered = true;
+        updateJoints();
+        return true;
+    }
+
     virtual void render(Frustum *frustum, MeshBuilder *mesh, Shader::Type type, bool caustics) {
         mat4 matrix = getMatrix();
 
@@ -227,6 +227,196 @@ struct LockWrite {
 #define OS_LOCK_READ(rwLock)  LockRead  _rLock(rwLock)
 #define OS_LOCK_WRITE(rwLock) LockWrite _wLock(rwLock)
 
+typedef void* (ThreadProc)(void *arg);
+
+extern void* osThreadCreate  (ThreadProc *proc, void *arg);
+extern void  osThreadJoin    (void *obj);
+extern int   osGetCPUCount   ();
+
+extern void* osEventInit     ();
+extern void  osEventFree     (void *obj);
+extern void  osEventSignal   (void *obj);
+extern void  osEventWait     (void *obj);
+
+#define MAX_JOB_THREADS 16
+#define MAX_JOB_TASKS   16
+
+#if defined(_PSP) || defined(__EMSCRIPTEN__)
+    #define NO_THREADS // osThreadCreate runs in place, jobs and tasks run on the calling thread
+#endif
+
+typedef void (JobProc)(void *userData, int start, int end);
+
+struct JobRange {
+    JobProc *proc;
+    void    *userData;
+    int     start, end;
+
+    static void* run(void *arg) {
+        JobRange *range = (JobRange*)arg;
+        range->proc(range->userData, range->start, range->end);
+        return NULL;
+    }
+};
+
+// worker threads of parallelFor and a background thread for the tasks (streaming), started on the first use and kept until Core::deinit
+struct JobPool {
+    struct Worker {
+        void     *thread;
+        void     *wake, *done;
+        JobRange range;
+        bool     quit;
+    } workers[MAX_JOB_THREADS - 1];
+
+    int   count; // -1 until started, 0 if the platform has a single core or no threads
+    bool  busy;
+    Mutex lock;
+
+    JobRange tasks[MAX_JOB_TASKS]; // queue of the background thread
+    int      tasksFirst, tasksCount;
+    Worker   tasker;
+
+    JobPool() : count(-1), busy(false), tasksFirst(0), tasksCount(0) {}
+
+    static void* work(void *arg) {
+        Worker *w = (Worker*)arg;
+        while (1) {
+            osEventWait(w->wake);
+            if (w->quit) break;
+            JobRange::run(&w->range);
+            osEventSignal(w->done);
+        }
+        return NULL;
+    }
+
+    bool popTask(JobRange &task) {
+        OS_LOCK(lock);
+        if (!tasksCount) return false;
+        task = tasks[tasksFirst];
+        tasksFirst = (tasksFirst + 1) % MAX_JOB_TASKS;
+        tasksCount--;
+        return true;
+    }
+
+    static void* taskWork(void *arg) {
+        JobPool *pool = (JobPool*)arg;
+        while (1) {
+            osEventWait(pool->tasker.wake);
+            JobRange task;
+            while (pool->popTask(task))
+                JobRange::run(&task);
+            if (pool->tasker.quit) break;
+        }
+        return NULL;
+    }
+
+    void start() {
+    #ifdef NO_THREADS
+        count = 0;
+    #else
+        count = clamp(osGetCPUCount() - 1, 0, MAX_JOB_THREADS - 1);
+        for (int i = 0; i < count; i++) {
+            Worker &w = workers[i];
+            w.wake   = osEventInit();
+            w.done   = osEventInit();
+            w.quit   = false;
+            w.thread = osThreadCreate(work, &w);
+        }
+
+        tasker.wake   = osEventInit();
+        tasker.quit   = false;
+        tasker.thread = osThreadCreate(taskWork, this);
+    #endif
+    }
+
+    void stop() {
+        if (count < 0) return;
+    #ifndef NO_THREADS
+        tasker.quit = true; // the queued tasks are done first
+        osEventSignal(tasker.wake);
+        osThreadJoin(tasker.thread);
+        osEventFree(tasker.wake);
+    #endif
+
+        OS_LOCK(lock);
+        for (int i = 0; i < count; i++) {
+            Worker &w = workers[i];
+            w.quit = true;
+            osEventSignal(w.wake);
+            osThreadJoin(w.thread);
+            osEventFree(w.wake);
+            osEventFree(w.done);
+        }
+        count = -1;
+    }
+
+// run the task on the background thread (in order with the other tasks), the task signals its completion itself
+    void async(JobProc *proc, void *userData) {
+        JobRange task;
+        task.proc     = proc;
+        task.userData = userData;
+        task.start    = 0;
+        task.end      = 1;
+
+    #ifndef NO_THREADS
+        {
+            OS_LOCK(lock);
+            if (count < 0) start();
+            if (tasksCount < MAX_JOB_TASKS) {
+                tasks[(tasksFirst + tasksCount++) % MAX_JOB_TASKS] = task;
+                osEventSignal(tasker.wake);
+                return;
+            }
+        }
+        LOG("! job tasks overflow\n");
+    #endif
+        JobRange::run(&task);
+    }
+
+// the workers serve one parallelFor at a time, a concurrent call (e.g. from the loader thread) runs on its own thread
+    bool acquire() {
+        OS_LOCK(lock);
+        if (busy) return false;
+        if (count < 0) start();
+        busy = true;
+        return true;
+    }
+
+    void release() {
+        OS_LOCK(lock);
+        busy = false;
+    }
+} jobPool;
+
+// split [0, count) between the calling thread and the pool workers and wait for all ranges
+void parallelFor(int count, JobProc *proc, void *userData) {
+    bool owner   = jobPool.acquire();
+    int  threads = clamp(min(owner ? jobPool.count + 1 : 1, count), 1, MAX_JOB_THREADS);
+
+    JobRange range;
+    range.proc     = proc;
+    range.userData = userData;
+    range.start    = 0;
+    range.end      = count / threads;
+
+    for (int i = 1; i < threads; i++) {
+        JobPool::Worker &w = jobPool.workers[i - 1];
+        w.range.proc     = proc;
+        w.range.userData = userData;
+        w.range.start    = count * i / threads;
+        w.range.end      = count * (i + 1) / threads;
+        osEventSignal(w.wake);
+    }
+
+    JobRange::run(&range);
+
+    for (int i = 1; i < threads; i++)
+        osEventWait(jobPool.workers[i - 1].done);
+
+    if (owner)
+        jobPool.release();
+}
+
 enum InputKey { ikNone,
 // keyboard
     ikLeft, ikRight, ikUp, ikDown, ikSpace, ikTab, ikEnter, ikEscape, ikShift, ikCtrl, ikAlt,
@@ -271,6 +461,8 @@ namespace Core {
         bool depthTexture;
         bool shadowSampler;
         bool discardFrame;
+        bool pixelBuffer;
+        bool fence;
         bool texNPOT;
         bool texRG;
         bool texBorder;
@@ -446,6 +638,12 @@ namespace Core {
         PFNGLBINDBUFFERARBPROC              glBindBuffer;
         PFNGLBUFFERDATAARBPROC              glBufferData;
         PFNGLBUFFERSUBDATAARBPROC           glBufferSubData;
+    // Readback
+        PFNGLMAPBUFFERARBPROC               glMapBuffer;
+        PFNGLUNMAPBUFFERARBPROC             glUnmapBuffer;
+        PFNGLFENCESYNCPROC                  glFenceSync;
+        PFNGLDELETESYNCPROC                 glDeleteSync;
+        PFNGLCLIENTWAITSYNCPROC             glClientWaitSync;
     #endif
 
     PFNGLGENVERTEXARRAYSPROC            glGenVertexArrays;
@@ -659,23 +857,37 @@ namespace Core {
     } reqTarget;
 
     struct Stats {
-        int dips, tris, frame, fps, fpsTime;
+        int dips, tris, rooms, entities, clipped, shaders, textures, states, instances, frame, fps, fpsTime;
+    // shadow map cache (per second): passes, skipped passes, saved DIPs and CPU time (ms)
+        int   shadows, shadowsSkipped, shadowsSavedDips;
+        float shadowsSavedTime;
+    // simulation (per second): ticks and CPU time of the updates (ms)
+        int   ticks;
+        float tickTime;
     #ifdef PROFILE
         int tFrame;
     #endif
 
-        Stats() : frame(0), fps(0), fpsTime(0) {}
+        Stats() : frame(0), fps(0), fpsTime(0), shadows(0), shadowsSkipped(0), shadowsSavedDips(0), shadowsSavedTime(0.0f), ticks(0), tickTime(0.0f) {}
 
         void start() {
-            dips = tris = 0;
+            dips = tris = rooms = entities = clipped = shaders = textures = states = instances = 0;
         }
 
         void stop() {
             if (fpsTime < Core::getTime()) {
-                LOG("FPS: %d DIP: %d TRI: %d\n", fps, dips, tris);
+                LOG("FPS: %d DIP: %d TRI: %d ROOMS: %d ENTITIES: %d CLIPPED: %d SHADERS: %d TEXTURES: %d STATES: %d INSTANCES: %d\n", fps, dips, tris, rooms, entities, clipped, shaders, textures, states, instances);
+                if (shadows) {
+                    LOG("SHADOWS: %d SKIPPED: %d SAVED DIP: %d CPU: %.2f ms\n", shadows, shadowsSkipped, shadowsSavedDips, shadowsSavedTime);
+                }
+                LOG("TICKS: %d UPDATE CPU: %.2f ms\n", ticks, tickTime);
             #ifdef PROFILE
                 LOG("frame time: %d mcs\n", tFrame / 1000);
             #endif
+                shadows = shadowsSkipped = shadowsSavedDips = 0;
+                shadowsSavedTime = 0.0f;
+                ticks    = 0;
+                tickTime = 0.0f;
                 fps     = frame;
                 frame   = 0;
                 fpsTime = Core::getTime() + 1000;
@@ -812,6 +1024,12 @@ namespace Core {
                 GetProcOGL(glBindBuffer);
                 GetProcOGL(glBufferData);
                 GetProcOGL(glBufferSubData);
+
+                GetProcOGL(glMapBuffer);
+                GetProcOGL(glUnmapBuffer);
+                GetProcOGL(glFenceSync);
+                GetProcOGL(glDeleteSync);
+                GetProcOGL(glClientWaitSync);
             #endif
 
             #if defined(ANDROID) || defined(__EMSCRIPTEN__)
@@ -861,6 +1079,8 @@ namespace Core {
         support.depthTexture   = false;
         support.shadowSampler  = false;
         support.discardFrame   = false;
+        support.pixelBuffer    = false;
+        support.fence          = false;
         support.texNPOT        = false;
         support.texRG          = false;
         support.texBorder      = false;
@@ -877,6 +1097,13 @@ namespace Core {
         support.depthTexture   = extSupport(ext, "_depth_texture");
         support.shadowSampler  = support.depthTexture && (extSupport(ext, "_shadow_samplers") || extSupport(ext, "GL_ARB_shadow"));
         support.discardFrame   = extSupport(ext, "_discard_framebuffer");
+    #if defined(WIN32) || defined(LINUX)
+        support.pixelBuffer    = extSupport(ext, "_pixel_buffer_object");
+        support.fence          = extSupport(ext, "GL_ARB_sync");
+    #else
+        support.pixelBuffer    = false;
+        support.fence          = false;
+    #endif
         support.texNPOT        = extSupport(ext, "_texture_npot") || extSupport(ext, "_texture_non_power_of_two");
         support.texRG          = extSupport(ext, "_texture_rg ");   // hope that isn't last extension in string ;)
         support.texBorder      = extSupport(ext, "_texture_border_clamp");
@@ -913,6 +1140,7 @@ namespace Core {
         LOG("  depth texture  : %s\n", support.depthTexture  ? "true" : "false");
         LOG("  shadow sampler : %s\n", support.shadowSampler ? "true" : "false");
         LOG("  discard frame  : %s\n", support.discardFrame  ? "true" : "false");
+        LOG("  pixel buffer   : %s\n", support.pixelBuffer   ? (support.fence ? "fence" : "true") : "false");
         LOG("  NPOT textures  : %s\n", support.texNPOT       ? "true" : "false");
         LOG("  RG   textures  : %s\n", support.texRG         ? "true" : "false");
         LOG("  border color   : %s\n", support.texBorder     ? "true" : "false");
@@ -1097,6 +1325,8 @@ namespace Core {
     }
 
     void deinit() {
+        jobPool.stop();
+
         delete eyeTex[0];
         delete eyeTex[1];
         delete whiteTex;
@@ -1157,6 +1387,8 @@ namespace Core {
         int32 mask = renderState ^ active.renderState;
         if (!mask) return;
 
+        stats.states++;
+
         if (mask & RS_TARGET) {
             Texture *target = reqTarget.texture;
             uint8   face    = reqTarget.face;
@@ -1421,6 +1653,93 @@ namespace Core {
     #endif
     }
 
+    // asynchronous readback of single pixels through the pixel pack buffer, results are fetched a few frames later
+    // without the GPU sync (or immediately if not supported)
+    struct PixelBuffer {
+        ubyte4 *data;
+        int    count;
+    #if defined(WIN32) || defined(LINUX)
+        GLuint ID;
+        GLsync sync;
+    #endif
+
+        PixelBuffer(int count) : count(count) {
+            data = new ubyte4[count];
+        #if defined(WIN32) || defined(LINUX)
+            ID   = 0;
+            sync = 0;
+            if (support.pixelBuffer) {
+                glGenBuffers(1, &ID);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, ID);
+                glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(ubyte4) * count, NULL, GL_STREAM_READ);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            }
+        #endif
+        }
+
+        ~PixelBuffer() {
+        #if defined(WIN32) || defined(LINUX)
+            if (sync) glDeleteSync(sync);
+            if (ID)   glDeleteBuffers(1, &ID);
+        #endif
+            delete[] data;
+        }
+
+    // read pixel of the current target into the index slot
+        void read(int index, int x, int y) {
+            ASSERT(index < count);
+        #if defined(WIN32) || defined(LINUX)
+            if (ID) {
+                validateRenderState();
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, ID);
+                glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, (void*)(sizeof(ubyte4) * index));
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                return;
+            }
+        #endif
+        #ifdef _PSP
+            data[index] = ubyte4(0, 0, 0, 0);
+        #else
+            validateRenderState();
+            glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &data[index]); // GPU sync!
+        #endif
+        }
+
+    // all reads are issued
+        void submit() {
+        #if defined(WIN32) || defined(LINUX)
+            if (ID && support.fence) {
+                if (sync) glDeleteSync(sync);
+                sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            }
+        #endif
+        }
+
+    // copy results to data if the GPU is done (or anyway if force), returns false if still in flight
+        bool fetch(bool force) {
+        #if defined(WIN32) || defined(LINUX)
+            if (!ID) return true;
+
+            if (sync) {
+                if (!force && glClientWaitSync(sync, 0, 0) == GL_TIMEOUT_EXPIRED)
+                    return false;
+                glDeleteSync(sync);
+                sync = 0;
+            } else if (!force)
+                return false;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, ID);
+            void *ptr = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+            if (ptr) {
+                memcpy(data, ptr, sizeof(ubyte4) * count);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        #endif
+            return true;
+        }
+    };
+
     void beginFrame() {
         //memset(&active, 0, sizeof(active));        
         setViewport(0, 0, Core::width, Core::height);
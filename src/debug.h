@@ -697,7 +697,9 @@ namespace Debug {
             }
 
             char buf[255];
-            sprintf(buf, "DIP = %d, TRI = %d, SND = %d, active = %d", Core::stats.dips, Core::stats.tris, Sound::channelsCount, activeCount);
+            sprintf(buf, "DIP = %d, TRI = %d, ROOMS = %d, ENTITIES = %d, CLIPPED = %d, STATES = %d/%d/%d, SND = %d (cache %d%%), active = %d", Core::stats.dips, Core::stats.tris, Core::stats.rooms, Core::stats.entities, Core::stats.clipped, Core::stats.shaders, Core::stats.textures, Core::stats.states, Sound::channelsCount, Sound::cache.stats.getHitRate(), activeCount);
+            Debug::Draw::text(vec2(16, y += 16), vec4(1.0f), buf);
+            sprintf(buf, "SHADOWS = %d/%d skipped, saved DIP = %d, CPU = %.2f ms", Core::stats.shadowsSkipped, Core::stats.shadows, Core::stats.shadowsSavedDips, Core::stats.shadowsSavedTime);
             Debug::Draw::text(vec2(16, y += 16), vec4(1.0f), buf);
             vec3 angle = controller->angle * RAD2DEG;
             sprintf(buf, "pos = (%d, %d, %d), angle = (%d, %d), room = %d (camera: %d)", int(controller->pos.x), int(controller->pos.y), int(controller->pos.z), (int)angle.x, (int)angle.y, controller->getRoomIndex(), game->getCamera()->getRoomIndex());
@@ -68,9 +68,19 @@ struct Enemy : Character {
     bool  targetFromView;   // enemy in target view zone
     bool  targetCanAttack;
 
+    struct Sense {              // world state gathered by the read phase of the tick (see prepare)
+        int        tick;        // IGame::getTickIndex of the read phase
+        bool       flipped;
+        int        roomIndex;   // state of the enemy it was gathered for
+        vec3       pos;
+        int        room;        // Character::getRoomIndex at pos
+        Character *target;      // the nearest alive player
+    } sense;
+
     Enemy(IGame *game, int entity, float health, int radius, float length, float aggression) : Character(game, entity, health), ai(AI_RANDOM), mood(MOOD_SLEEP), wound(false), nextState(0), targetBox(-1), thinkTime(1.0f / 30.0f), length(length), aggression(aggression), radius(radius), hitSound(-1), target(NULL), path(NULL) {
         targetDist   = +INF;
         targetInView = targetFromView = targetCanAttack = false;
+        sense.tick   = -1;
     }
 
     virtual ~Enemy() {
@@ -97,6 +107,31 @@ struct Enemy : Character {
         return health > 0.0f && Character::activate();
     }
 
+// the floor under the enemy and the target player as of the tick start, changes made by the other entities during the tick
+// (trap doors, the second player passing by) are not seen by the enemy until the next tick
+    virtual void prepare() {
+        sense.pos       = pos;
+        sense.roomIndex = roomIndex;
+        sense.flipped   = level->state.flags.flipped;
+        sense.room      = Character::getRoomIndex();
+        sense.target    = (Character*)game->getLara(pos);
+        sense.tick      = game->getTickIndex();
+    }
+
+    bool isSensed() const {
+        return sense.tick == game->getTickIndex() && sense.pos == pos && sense.roomIndex == roomIndex && sense.flipped == bool(level->state.flags.flipped);
+    }
+
+    virtual int getRoomIndex() const {
+        return isSensed() ? sense.room : Character::getRoomIndex();
+    }
+
+#ifdef _DEBUG
+    virtual bool checkPrepare() {
+        return !isSensed() || (sense.room == Character::getRoomIndex() && sense.target == game->getLara(pos));
+    }
+#endif
+
     virtual void updateVelocity() {
         if (stand == STAND_AIR && (!flying || health <= 0.0f))
             applyGravity(velocity.y);
@@ -295,7 +330,7 @@ struct Enemy : Character {
             return false;
         thinkTime -= 1.0f / 30.0f;
 
-        target = (Character*)game->getLara(pos);
+        target = isSensed() ? sense.target : (Character*)game->getLara(pos); // activated or moved since the read phase
 
         vec3 targetVec  = target->pos - pos - getDir() * length;
         targetDist      = targetVec.length();
@@ -1295,9 +1330,7 @@ struct Doppelganger : Enemy {
                 pos += velocity * (30.0f * Core::deltaTime);
             }
         } else {
-            animation.frameA = target->animation.frameA;
-            animation.frameB = target->animation.frameB;
-            animation.delta  = target->animation.delta;
+            animation.setFrames(target->animation);
         }
     }
 
@@ -4,6 +4,10 @@
 #include "utils.h"
 #include "gameflow.h"
 
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
 #define MAX_RESERVED_ENTITIES 128
 #define MAX_FLIPMAP_COUNT     32
 #define MAX_TRACKS_COUNT      256
@@ -1139,12 +1143,6 @@ namespace TR {
         }
     };
 
-    // used for access from ::cmp func
-    static ObjectTexture *gObjectTextures = NULL;
-    static SpriteTexture *gSpriteTextures = NULL;
-    static int            gObjectTexturesCount;
-    static int            gSpriteTexturesCount;
-
     struct Face {
         union {
             struct { uint16 texture:15, doubleSided:1; };
@@ -1154,39 +1152,47 @@ namespace TR {
         uint8  vCount;  // !!! not existing in file
         uint16 vertices[4];
 
-        static int cmp(const Face &a, const Face &b) {
-            int aIndex = a.flags.texture;
-            int bIndex = b.flags.texture;
-            if (aIndex >= gObjectTexturesCount)
-                return 1;
-            if (bIndex >= gObjectTexturesCount)
-                return -1;
+    // order by the object textures of the level the faces belong to
+        struct Cmp {
+            const ObjectTexture *textures;
+            int                  count;
 
-            ASSERT(aIndex < gObjectTexturesCount);
-            ASSERT(bIndex < gObjectTexturesCount);
+            Cmp(const ObjectTexture *textures, int count) : textures(textures), count(count) {}
 
-            ObjectTexture &ta = gObjectTextures[aIndex];
-            ObjectTexture &tb = gObjectTextures[bIndex];
+            int operator () (const Face &a, const Face &b) const {
+                int aIndex = a.flags.texture;
+                int bIndex = b.flags.texture;
+                if (aIndex >= count)
+                    return 1;
+                if (bIndex >= count)
+                    return -1;
+
+                ASSERT(aIndex < count);
+                ASSERT(bIndex < count);
 
-            if (ta.tile.index < tb.tile.index)
-                return -1;
-            if (ta.tile.index > tb.tile.index)
-                return  1;
+                const ObjectTexture &ta = textures[aIndex];
+                const ObjectTexture &tb = textures[bIndex];
 
-            #ifdef SPLIT_BY_CLUT
-                if (ta.clut < tb.clut)
+                if (ta.tile.index < tb.tile.index)
                     return -1;
-                if (ta.clut > tb.clut)
+                if (ta.tile.index > tb.tile.index)
                     return  1;
-            #endif
 
-            if (aIndex < bIndex)
-                return -1;
-            if (aIndex > bIndex)
-                return  1;
+                #ifdef SPLIT_BY_CLUT
+                    if (ta.clut < tb.clut)
+                        return -1;
+                    if (ta.clut > tb.clut)
+                        return  1;
+                #endif
+
+                if (aIndex < bIndex)
+                    return -1;
+                if (aIndex > bIndex)
+                    return  1;
 
-            return 0;
-        }
+                return 0;
+            }
+        };
     };
 
     #define FACE4_SIZE (sizeof(Face) - sizeof(uint8) - sizeof(uint8))
@@ -1243,32 +1249,40 @@ namespace TR {
                 int16       vertex;
                 int16       texture;
 
-                static int cmp(const Sprite &a, const Sprite &b) {
-                    ASSERT(a.texture < gSpriteTexturesCount);
-                    ASSERT(b.texture < gSpriteTexturesCount);
+            // order by the sprite textures of the level the sprites belong to
+                struct Cmp {
+                    const SpriteTexture *textures;
+                    int                  count;
 
-                    SpriteTexture &ta = gSpriteTextures[a.texture];
-                    SpriteTexture &tb = gSpriteTextures[b.texture];
+                    Cmp(const SpriteTexture *textures, int count) : textures(textures), count(count) {}
 
-                    if (ta.tile < tb.tile)
-                        return -1;
-                    if (ta.tile > tb.tile)
-                        return  1;
+                    int operator () (const Sprite &a, const Sprite &b) const {
+                        ASSERT(a.texture < count);
+                        ASSERT(b.texture < count);
+
+                        const SpriteTexture &ta = textures[a.texture];
+                        const SpriteTexture &tb = textures[b.texture];
 
-                    #ifdef SPLIT_BY_CLUT
-                        if (ta.clut < tb.clut)
+                        if (ta.tile < tb.tile)
                             return -1;
-                        if (ta.clut > tb.clut)
+                        if (ta.tile > tb.tile)
                             return  1;
-                    #endif
 
-                    if (a.texture < b.texture)
-                        return -1;
-                    if (a.texture > b.texture)
-                        return  1;
+                        #ifdef SPLIT_BY_CLUT
+                            if (ta.clut < tb.clut)
+                                return -1;
+                            if (ta.clut > tb.clut)
+                                return  1;
+                        #endif
 
-                    return 0;
-                }
+                        if (a.texture < b.texture)
+                            return -1;
+                        if (a.texture > b.texture)
+                            return  1;
+
+                        return 0;
+                    }
+                };
 
             } *sprites;
         } data;
@@ -1384,6 +1398,15 @@ namespace TR {
         }
     };
 
+    #define MAX_PORTAL_DEPTH 16
+
+    struct PortalInfo { // world space room portal (vertices in SoA order for 4-wide projection)
+        float   x[4], y[4], z[4];
+        vec3    normal;
+        float   dist;
+        int32   roomIndex;
+    };
+
     union FloorData {
         uint16 data;
         struct Command {
@@ -1453,11 +1476,7 @@ namespace TR {
         Vertex      *vertices;
         Face        *faces;
 
-        Mesh() : vertices(0), faces(0) {}
-        ~Mesh() {
-            delete[] vertices;
-            delete[] faces;
-        }
+        Mesh() : vertices(0), faces(0) {} // geometry is owned by the level arena
     };
 
     struct Entity {
@@ -2018,6 +2037,32 @@ namespace TR {
         #undef ANGLE_SCALE
     };
 
+    struct AnimEvent {  // sound or effect command of the animation frame (see AnimCommands)
+        uint16  type;   // ANIM_CMD_SOUND or ANIM_CMD_EFFECT
+        int16   value;  // sound or effect id with flags
+    };
+
+    struct AnimCommands {   // compiled command stream of the animation (see Level::initAnimCommands)
+        vec3    offset;     // last ANIM_CMD_OFFSET
+        vec3    jump;       // last ANIM_CMD_JUMP (y, z)
+        bool    hasJump;
+        bool    hasFlip;    // the last effect command is ROTATE_180
+        bool    ordered;    // EMPTY or KILL follows a frame event, the command stream must be walked in order
+        uint8   empty;      // ANIM_CMD_EMPTY count
+        uint8   kill;       // ANIM_CMD_KILL count
+        int32   flipFrame;  // frame of ROTATE_180 (see hasFlip)
+        int32   events;     // offset of the frame event ranges in animEventFrames (frames + 1 entries), -1 if there are no events
+        int32   frames;     // count of frames that may have events
+    };
+
+    struct AnimFrames { // decoded frames of the animation (see Level::initAnimFrames)
+        int32   rot;    // offset of the first frame in framesRot, frame = x[stride], y[stride], z[stride], w[stride] of joint rotations
+        uint16  count;  // real frames count (0 - not decoded)
+        uint16  joints;
+        uint16  stride; // joints count aligned to 4
+        uint16  align;
+    };
+
     struct AnimTexture {
         int16   count;        // number of texture offsets - 1 in group
         int16   textures[1];  // offsets into objectTextures[]
@@ -2242,6 +2287,7 @@ namespace TR {
     struct Level {
         Version         version;
         LevelID         id;
+        uint32          hash;       // level file hash (baked data cache key)
 
         int32           tilesCount;
         Tile32          *tiles;
@@ -2277,6 +2323,12 @@ namespace TR {
 
         int32           frameDataSize;
         uint16          *frameData;
+        AnimFrames      *animFrames;    // per animation
+        AnimCommands    *animCommands;  // per animation
+        AnimEvent       *animEvents;
+        int32           *animEventFrames;
+        int32           framesRotSize;
+        float           *framesRot;
 
         int32           modelsCount;
         Model           *models;
@@ -2312,6 +2364,14 @@ namespace TR {
         int32           entitiesCount;
         Entity          *entities;
 
+        int32           portalInfosCount;
+        PortalInfo      *portalInfos;
+        int32           *roomPortals;   // index of the first room portal in portalInfos
+        int32           portalsMax;     // max portals per room
+
+        int32           pvsStride;      // uint32 words per room row
+        uint32          *pvs[2];        // rooms potentially visible from a room, for normal and flipped state
+
         int32           paletteSize;
         Color24         *palette;
         Color32         *palette32;
@@ -2341,6 +2401,11 @@ namespace TR {
         uint32          *soundOffsets;
         uint32          *soundSize;
 
+        Arena           arena;      // owns the level data (see Stream::arena)
+    #ifdef USE_MMAP
+        Stream::Map     maps[2];    // level & SFX file mappings, fixed-layout arrays are views into them
+    #endif
+
         SaveGame                save;
         SaveGame::CurrentState  state;
 
@@ -2429,6 +2494,7 @@ namespace TR {
         } extra;
 
         Level(Stream &stream) : version(VER_UNKNOWN), soundData(NULL), soundOffsets(NULL), soundSize(NULL) {
+            LOAD_PHASE("parse");
             int startPos = stream.pos;
             memset(this, 0, sizeof(*this));
             cutEntity = -1;
@@ -2477,16 +2543,20 @@ namespace TR {
                 return;
             }
 
+        // level data lives in the arena (except tiles, released after atlas building) and is freed at once
+            arena.reserve(stream.size);
+            stream.arena = &arena;
+
             if (version == VER_TR2_PSX) {
                 stream.read(soundOffsets, stream.read(soundOffsetsCount) + 1);
-                soundSize = new uint32[soundOffsetsCount];
+                soundSize = arena.alloc<uint32>(soundOffsetsCount);
                 soundDataSize = 0;
                 for (int i = 0; i < soundOffsetsCount; i++) {
                     soundSize[i]    = soundOffsets[i + 1] - soundOffsets[i];
                     soundOffsets[i] = soundDataSize;
                     soundDataSize  += soundSize[i];
                 }
-                stream.read(soundData, soundDataSize);
+                stream.view(soundData, soundDataSize);
             }
 
             if (version == VER_TR2_PC || version == VER_TR3_PC) {
@@ -2504,8 +2574,8 @@ namespace TR {
                 stream.read(numSounds);
                 stream.setPos(startPos + 2086 + numSounds * 512);
                 soundOffsetsCount = numSounds;
-                soundOffsets = new uint32[soundOffsetsCount];
-                soundSize    = new uint32[soundOffsetsCount];
+                soundOffsets = arena.alloc<uint32>(soundOffsetsCount);
+                soundSize    = arena.alloc<uint32>(soundOffsetsCount);
                 soundDataSize = 0;
                 for (int i = 0; i < soundOffsetsCount; i++) {
                     soundOffsets[i] = soundDataSize;
@@ -2515,44 +2585,44 @@ namespace TR {
                 }           
             // sound data
                 stream.setPos(startPos + 2600 + numSounds * 512);
-                stream.read(soundData, soundDataSize);
+                stream.view(soundData, soundDataSize);
                 stream.setPos(startPos + offsetTexTiles + 8);
             }
 
             if (version & VER_PC) {
             // tiles
-                stream.read(tiles8, stream.read(tilesCount));
+                readTiles(stream, tiles8, stream.read(tilesCount));
             }
 
             if (version == VER_TR2_PC || version == VER_TR3_PC) 
-                stream.read(tiles16, tilesCount);
+                readTiles(stream, tiles16, tilesCount);
 
             if (version == VER_TR1_PSX) {
             // tiles
-                stream.read(tiles4, tilesCount = 13);
-                stream.read(cluts,  clutsCount = 1024);
+                readTiles(stream, tiles4, tilesCount = 13);
+                readTiles(stream, cluts,  clutsCount = 1024);
                 //stream.seek(0x4000);
             }
             stream.read(unused);
 
         // rooms
-            rooms = stream.read(roomsCount) ? new Room[roomsCount] : NULL;
+            rooms = stream.read(roomsCount) ? arena.alloc<Room>(roomsCount) : NULL;
             for (int i = 0; i < roomsCount; i++) 
                 readRoom(stream, rooms[i]);
 
         // floors
-            stream.read(floors,    stream.read(floorsCount));
+            stream.view(floors,    stream.read(floorsCount));
         // meshes
             readMeshes(stream);
         // animations
-            stream.read(anims,     stream.read(animsCount));
+            stream.view(anims,     stream.read(animsCount));
             stream.read(states,    stream.read(statesCount));
             stream.read(ranges,    stream.read(rangesCount));
-            stream.read(commands,  stream.read(commandsCount));
+            stream.view(commands,  stream.read(commandsCount));
             stream.read(nodesData, stream.read(nodesDataSize));
-            stream.read(frameData, stream.read(frameDataSize));
+            stream.view(frameData, stream.read(frameDataSize));
         // models
-            models = stream.read(modelsCount) ? new Model[modelsCount] : NULL;
+            models = stream.read(modelsCount) ? arena.alloc<Model>(modelsCount) : NULL;
             for (int i = 0; i < modelsCount; i++) {
                 Model &m = models[i];
                 uint16 type;
@@ -2570,8 +2640,8 @@ namespace TR {
             stream.read(staticMeshes, stream.read(staticMeshesCount));
 
             if (version == VER_TR2_PSX) {
-                stream.read(tiles4, stream.read(tilesCount));
-                stream.read(cluts, stream.read(clutsCount));
+                readTiles(stream, tiles4, stream.read(tilesCount));
+                readTiles(stream, cluts, stream.read(clutsCount));
                 //stream.read(palette32, stream.read(paletteSize));
                 stream.seek(4);
             }
@@ -2587,40 +2657,35 @@ namespace TR {
         // sound sources
             stream.read(soundSources,   stream.read(soundSourcesCount));
         // AI
-            boxes = stream.read(boxesCount) ? new Box[boxesCount] : NULL;
-            for (int i = 0; i < boxesCount; i++) {
-                Box &b = boxes[i];
-                if (version & VER_TR1) {
-                    stream.read(b.minZ);
-                    stream.read(b.maxZ);
-                    stream.read(b.minX);
-                    stream.read(b.maxX);
-                }
-                
-                if (version & (VER_TR2 | VER_TR3)) {
+            stream.read(boxesCount);
+            if (version & VER_TR1) {
+                stream.view(boxes, boxesCount); // same layout as Box
+            } else {
+                boxes = boxesCount ? arena.alloc<Box>(boxesCount) : NULL;
+                for (int i = 0; i < boxesCount; i++) {
+                    Box &b = boxes[i];
                     uint8 value;
                     b.minZ = stream.read(value) * 1024;
                     b.maxZ = stream.read(value) * 1024;
                     b.minX = stream.read(value) * 1024;
                     b.maxX = stream.read(value) * 1024;
+                    stream.read(b.floor);
+                    stream.read(b.overlap.value);
                 }
-
-                stream.read(b.floor);
-                stream.read(b.overlap.value);
             }
 
-            stream.read(overlaps, stream.read(overlapsCount));
+            stream.view(overlaps, stream.read(overlapsCount));
             for (int i = 0; i < 2; i++) {
-                stream.read(zones[i].ground1, boxesCount);
-                stream.read(zones[i].ground2, boxesCount);
+                stream.view(zones[i].ground1, boxesCount);
+                stream.view(zones[i].ground2, boxesCount);
                 if (!(version & VER_TR1)) {
-                    stream.read(zones[i].ground3, boxesCount);
-                    stream.read(zones[i].ground4, boxesCount);
+                    stream.view(zones[i].ground3, boxesCount);
+                    stream.view(zones[i].ground4, boxesCount);
                 } else {
                     zones[i].ground3 = NULL;
                     zones[i].ground4 = NULL;
                 }
-                stream.read(zones[i].fly, boxesCount);
+                stream.view(zones[i].fly, boxesCount);
             }
         // animated textures
             stream.read(animTexturesData,   stream.read(animTexturesDataSize));
@@ -2628,7 +2693,7 @@ namespace TR {
                 readObjectTex(stream);
         // entities (enemies, items, lara etc.)
             entitiesCount = stream.read(entitiesBaseCount) + MAX_RESERVED_ENTITIES;
-            entities = new Entity[entitiesCount];
+            entities = arena.alloc<Entity>(entitiesCount);
             for (int i = 0; i < entitiesBaseCount; i++) {
                 Entity &e = entities[i];
                 uint16 type;
@@ -2678,7 +2743,7 @@ namespace TR {
 
         // sounds
             stream.read(soundsMap,  (version & VER_TR1) ? 256 : 370);
-            soundsInfo = stream.read(soundsInfoCount) ? new SoundInfo[soundsInfoCount] : NULL;
+            soundsInfo = stream.read(soundsInfoCount) ? arena.alloc<SoundInfo>(soundsInfoCount) : NULL;
             for (int i = 0; i < soundsInfoCount; i++) {
                 SoundInfo &s = soundsInfo[i];
 
@@ -2703,7 +2768,7 @@ namespace TR {
             }
 
             if (version == VER_TR1_PC) {
-                stream.read(soundData,    stream.read(soundDataSize));
+                stream.view(soundData,    stream.read(soundDataSize));
                 stream.read(soundOffsets, stream.read(soundOffsetsCount));
             }
 
@@ -2718,76 +2783,65 @@ namespace TR {
                 stream.read(cameraFrames, stream.read(cameraFramesCount));
             }
 
+            if (version == VER_TR1_PC && palette) {
+                for (int i = 0; i < 256; i++) { // Amiga -> PC color palette
+                    Color24 &c = palette[i];
+                    c.r <<= 2;
+                    c.g <<= 2;
+                    c.b <<= 2;
+                }
+            }
+
             initRoomMeshes();
+            initPortals();
+            initPVS();
 
             memset(&state, 0, sizeof(state));
 
             initExtra();
             initCutscene();
+            initAnimFrames();
+            initAnimCommands();
+
+            hash = stream.getHash();
+            stream.arena = NULL;
+
+            LOG("level arena: %d allocs, %d KB used of %d KB\n", arena.allocs, arena.getUsed() / 1024, arena.capacity / 1024);
 
-            gObjectTextures = objectTextures;
-            gSpriteTextures = spriteTextures;
-            gObjectTexturesCount = objectTexturesCount;
-            gSpriteTexturesCount = spriteTexturesCount;
+        #ifdef USE_MMAP
+            maps[0] = stream.takeMap();
+        #endif
         }
 
         ~Level() {
             delete[] tiles;
-        // rooms
-            for (int i = 0; i < roomsCount; i++) {
-                Room &r = rooms[i];
-                delete[] r.data.vertices;
-                delete[] r.data.faces;
-                delete[] r.data.sprites;
-                delete[] r.portals;
-                delete[] r.sectors;
-                delete[] r.lights;
-                delete[] r.meshes;
-            }
-            delete[] rooms;
-            delete[] floors;
-            delete[] meshOffsets;
-            delete[] anims;
-            delete[] states;
-            delete[] ranges;
-            delete[] commands;
-            delete[] nodesData;
-            delete[] frameData;
-            delete[] models;
-            delete[] staticMeshes;
-            delete[] objectTextures;
-            delete[] spriteTextures;
-            delete[] spriteSequences;
-            delete[] cameras;
-            delete[] soundSources;
-            delete[] boxes;
-            delete[] overlaps;
-            for (int i = 0; i < 2; i++) {
-                delete[] zones[i].ground1;
-                delete[] zones[i].ground2;
-                delete[] zones[i].ground3;
-                delete[] zones[i].ground4;
-                delete[] zones[i].fly;
-            }
-            delete[] animTexturesData;
-            delete[] entities;
-            delete[] palette;
-            delete[] palette32;
-            delete[] cluts;
             delete[] tiles4;
             delete[] tiles8;
             delete[] tiles16;
-            delete[] cameraFrames;
-            delete[] demoData;
-            delete[] soundsMap;
-            delete[] soundsInfo;
-            delete[] soundData;
-            delete[] soundOffsets;
-            delete[] soundSize;
+            delete[] cluts;
+            arena.free();
+        #ifdef USE_MMAP
+            for (int i = 0; i < int(COUNT(maps)); i++)
+                maps[i].free();
+        #endif
+        }
+
+        template <typename T>
+        T* readTiles(Stream &stream, T *&a, int count) { // heap allocated, see initTiles & compactTextures
+            Arena *streamArena = stream.arena;
+            stream.arena = NULL;
+            stream.read(a, count);
+            stream.arena = streamArena;
+            return a;
         }
 
         void readSamples(Stream &stream) {
-            stream.read(soundData, soundDataSize = stream.size);
+            stream.arena = &arena;
+            stream.view(soundData, soundDataSize = stream.size);
+            stream.arena = NULL;
+        #ifdef USE_MMAP
+            maps[1] = stream.takeMap();
+        #endif
 
             int32 dataOffsets[512];
             int32 dataOffsetsCount = 0;
@@ -2888,6 +2942,188 @@ namespace TR {
             ASSERT(extra.glyphs != -1);
         }
 
+    // expand packed joint angles of every animation frame into quaternions once instead of decoding them per pose
+        void initAnimFrames() {
+            animFrames = arena.alloc<AnimFrames>(animsCount);
+            if (!animFrames) return;
+            memset(animFrames, 0, sizeof(AnimFrames) * animsCount);
+
+        // animations of the model are from model.animation to the next model animations
+            int32 *owner = new int32[animsCount];
+            for (int i = 0; i < animsCount; i++)
+                owner[i] = -1;
+
+            for (int i = 0; i < modelsCount; i++) {
+                const Model &m = models[i];
+                if (m.animation >= animsCount) continue;
+
+                int end = animsCount;
+                for (int j = 0; j < modelsCount; j++)
+                    if (models[j].animation > m.animation && models[j].animation < end)
+                        end = models[j].animation;
+
+                for (int j = m.animation; j < end; j++)
+                    if (owner[j] == -1)
+                        owner[j] = i;
+            }
+
+            framesRotSize = 0;
+            int framesCount = 0;
+            for (int i = 0; i < animsCount; i++) {
+                if (owner[i] == -1) continue;
+                const Model &m    = models[owner[i]];
+                const Animation &anim = anims[i];
+                if (!anim.frameRate || anim.frameEnd < anim.frameStart || !m.mCount) continue;
+
+                int frameSize = anim.frameSize ? anim.frameSize : (sizeof(AnimFrame) / 2 + m.mCount * 2);
+            // skip frames that may be truncated by the end of frame data (box, pos, TR1 joints count and 2 words per joint at most)
+                int size  = frameDataSize - int(anim.frameOffset / 2) - (9 + ((version & VER_TR1) ? 1 : 0) + m.mCount * 2);
+                if (size < 0) continue;
+                int count = min((anim.frameEnd - anim.frameStart) / anim.frameRate + 1, size / frameSize + 1);
+
+                AnimFrames &af = animFrames[i];
+                af.rot    = framesRotSize;
+                af.count  = count;
+                af.joints = m.mCount;
+                af.stride = (m.mCount + 3) & ~3;
+
+                framesRotSize += af.stride * 4 * count;
+                framesCount   += count;
+            }
+
+            framesRot = (float*)arena.alloc(sizeof(float) * framesRotSize, 16);
+
+            for (int i = 0; i < animsCount; i++) {
+                const AnimFrames &af = animFrames[i];
+                const Animation &anim = anims[i];
+                int frameSize = anim.frameSize ? anim.frameSize : (sizeof(AnimFrame) / 2 + af.joints * 2);
+
+                for (int j = 0; j < af.count; j++) {
+                    AnimFrame *frame = (AnimFrame*)&frameData[anim.frameOffset / 2 + j * frameSize];
+                    float *rot = framesRot + af.rot + j * af.stride * 4;
+                    for (int k = 0; k < af.stride; k++) {
+                        quat q = k < af.joints ? rotYXZ(frame->getAngle(version, k)) : quat(0, 0, 0, 1);
+                        rot[k]                 = q.x;
+                        rot[k + af.stride]     = q.y;
+                        rot[k + af.stride * 2] = q.z;
+                        rot[k + af.stride * 3] = q.w;
+                    }
+                }
+            }
+
+            delete[] owner;
+
+            LOG("anim frames: %d frames, %d KB\n", framesCount, int(sizeof(float) * framesRotSize + sizeof(AnimFrames) * animsCount) / 1024);
+        }
+
+    // split the command stream of every animation into constant values and frame events
+    // events of the frame are in the stream order, events outside of the animation frames are never due
+    // EMPTY and KILL are applied before the events, animations where the stream says otherwise are marked as ordered
+        void initAnimCommands() {
+            animCommands = arena.alloc<AnimCommands>(animsCount);
+            if (!animCommands) return;
+
+            int eventsCount = 0, framesCount = 0;
+            for (int i = 0; i < animsCount; i++) {
+                const Animation &anim = anims[i];
+                AnimCommands &ac = animCommands[i];
+                ac = AnimCommands();
+                ac.events    = -1;
+                ac.frames    = anim.frameEnd >= anim.frameStart ? anim.frameEnd - anim.frameStart + 1 : 0;
+
+                int16 *ptr = &commands[anim.animCommand];
+                for (int j = 0; j < anim.acCount && ptr < commands + commandsCount; j++) {
+                    switch (*ptr++) {
+                        case ANIM_CMD_OFFSET :
+                            ac.offset = vec3(float(ptr[0]), float(ptr[1]), float(ptr[2]));
+                            ptr += 3;
+                            break;
+                        case ANIM_CMD_JUMP :
+                            ac.jump    = vec3(0.0f, float(ptr[0]), float(ptr[1]));
+                            ac.hasJump = true;
+                            ptr += 2;
+                            break;
+                        case ANIM_CMD_EMPTY :
+                        case ANIM_CMD_KILL  :
+                            if (ptr[-1] == ANIM_CMD_EMPTY)
+                                ac.empty++;
+                            else
+                                ac.kill++;
+                            ac.ordered |= ac.events != -1;
+                            break;
+                        case ANIM_CMD_SOUND  :
+                        case ANIM_CMD_EFFECT : {
+                            int frame = ptr[0] - anim.frameStart;
+                            if (ptr[-1] == ANIM_CMD_EFFECT) {
+                                ac.hasFlip   = (ptr[1] & 0x3FFF) == Effect::ROTATE_180;
+                                ac.flipFrame = frame;
+                            }
+                            if (frame >= 0 && frame < ac.frames) {
+                                if (ac.events == -1) {
+                                    ac.events = framesCount;
+                                    framesCount += ac.frames + 1;
+                                }
+                                eventsCount++;
+                            }
+                            ptr += 2;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            animEvents      = arena.alloc<AnimEvent>(eventsCount);
+            animEventFrames = arena.alloc<int32>(framesCount);
+
+            int index = 0;
+            for (int i = 0; i < animsCount; i++) {
+                const Animation &anim = anims[i];
+                const AnimCommands &ac = animCommands[i];
+                if (ac.events == -1) continue;
+
+            // frame event ranges by counting sort
+                int32 *first = animEventFrames + ac.events;
+                memset(first, 0, sizeof(int32) * (ac.frames + 1));
+
+                for (int pass = 0; pass < 2; pass++) {
+                    int16 *ptr = &commands[anim.animCommand];
+                    for (int j = 0; j < anim.acCount && ptr < commands + commandsCount; j++) {
+                        int cmd = *ptr++;
+                        switch (cmd) {
+                            case ANIM_CMD_OFFSET : ptr += 3; break;
+                            case ANIM_CMD_JUMP   : ptr += 2; break;
+                            case ANIM_CMD_SOUND  :
+                            case ANIM_CMD_EFFECT : {
+                                int frame = ptr[0] - anim.frameStart;
+                                if (frame >= 0 && frame < ac.frames) {
+                                    if (pass == 0)
+                                        first[frame + 1]++;
+                                    else {
+                                        AnimEvent &e = animEvents[first[frame]++];
+                                        e.type  = cmd;
+                                        e.value = ptr[1];
+                                    }
+                                }
+                                ptr += 2;
+                                break;
+                            }
+                        }
+                    }
+
+                    if (pass == 0) {
+                        first[0] = index;
+                        for (int k = 1; k <= ac.frames; k++)
+                            first[k] += first[k - 1];
+                    } else { // first[k] was moved to the start of the next frame
+                        for (int k = ac.frames - 1; k > 0; k--)
+                            first[k] = first[k - 1];
+                        first[0] = index;
+                    }
+                }
+                index = first[ac.frames];
+            }
+        }
+
         void initCutscene() {
             if (id == LVL_TR3_CUT_2 || id == LVL_TR3_CUT_6)
                 cutEntity = 1; // TODO TR3
@@ -2974,7 +3210,7 @@ namespace TR {
         // room data
             stream.read(d.size);
             if (version == VER_TR1_PSX) stream.seek(2);
-            d.vertices = stream.read(d.vCount) ? new Room::Data::Vertex[d.vCount] : NULL;
+            d.vertices = stream.read(d.vCount) ? arena.alloc<Room::Data::Vertex>(d.vCount) : NULL;
             for (int i = 0; i < d.vCount; i++) {
                 Room::Data::Vertex &v = d.vertices[i];
 
@@ -3030,7 +3266,7 @@ namespace TR {
             stream.setPos(tmp);
 
             d.fCount = d.rCount + d.tCount;
-            d.faces  = d.fCount ? new Face[d.fCount] : NULL;
+            d.faces  = d.fCount ? arena.alloc<Face>(d.fCount) : NULL;
 
             int idx = 0;
 
@@ -3101,7 +3337,7 @@ namespace TR {
         // sectors
             stream.read(r.zSectors);
             stream.read(r.xSectors);
-            r.sectors = (r.zSectors * r.xSectors) ? new Room::Sector[r.zSectors * r.xSectors] : NULL;
+            r.sectors = (r.zSectors && r.xSectors) ? arena.alloc<Room::Sector>(r.zSectors * r.xSectors) : NULL;
 
             for (int i = 0; i < r.zSectors * r.xSectors; i++) {
                 Room::Sector &s = r.sectors[i];
@@ -3131,7 +3367,7 @@ namespace TR {
                 stream.read(r.lightMode);
 
         // lights
-            r.lights = stream.read(r.lightsCount) ? new Room::Light[r.lightsCount] : NULL;
+            r.lights = stream.read(r.lightsCount) ? arena.alloc<Room::Light>(r.lightsCount) : NULL;
             for (int i = 0; i < r.lightsCount; i++) {
                 Room::Light &light = r.lights[i];
                 stream.read(light.x);
@@ -3166,7 +3402,7 @@ namespace TR {
             }
         // meshes
             stream.read(r.meshesCount);
-            r.meshes = r.meshesCount ? new Room::Mesh[r.meshesCount] : NULL;
+            r.meshes = r.meshesCount ? arena.alloc<Room::Mesh>(r.meshesCount) : NULL;
             for (int i = 0; i < r.meshesCount; i++) {
                 Room::Mesh &m = r.meshes[i];
                 stream.read(m.x);
@@ -3244,7 +3480,7 @@ namespace TR {
                             short       ctCount;
                             Triangle    ctriangles[ctCount];
                         }; */
-                        mesh.vertices = new Mesh::Vertex[mesh.vCount];
+                        mesh.vertices = arena.alloc<Mesh::Vertex>(mesh.vCount);
                         for (int i = 0; i < mesh.vCount; i++) {
                             short4 &c = mesh.vertices[i].coord;
                             stream.read(c.x);
@@ -3281,7 +3517,7 @@ namespace TR {
                         mesh.rCount = rCount + crCount;
                         mesh.tCount = tCount + ctCount;
                         mesh.fCount = mesh.rCount + mesh.tCount;
-                        mesh.faces  = mesh.fCount ? new Face[mesh.fCount] : NULL;
+                        mesh.faces  = mesh.fCount ? arena.alloc<Face>(mesh.fCount) : NULL;
 
                         int idx = 0;
                         stream.seek(sizeof(rCount));  for (int i = 0; i < rCount; i++)  readFace(stream, mesh.faces[idx++], false, false);
@@ -3306,7 +3542,7 @@ namespace TR {
                         }; */
                         int nCount = mesh.vCount;
                         mesh.vCount = abs(mesh.vCount);
-                        mesh.vertices = new Mesh::Vertex[mesh.vCount];
+                        mesh.vertices = arena.alloc<Mesh::Vertex>(mesh.vCount);
 
                         for (int i = 0; i < mesh.vCount; i++)
                             stream.read(mesh.vertices[i].coord);
@@ -3338,7 +3574,7 @@ namespace TR {
                         stream.setPos(tmp);
 
                         mesh.fCount = mesh.rCount + mesh.tCount;
-                        mesh.faces  = mesh.fCount ? new Face[mesh.fCount] : NULL;
+                        mesh.faces  = mesh.fCount ? arena.alloc<Face>(mesh.fCount) : NULL;
 
                         int idx = 0;
                         stream.seek(sizeof(mesh.rCount)); for (int i = 0; i < mesh.rCount; i++) readFace(stream, mesh.faces[idx++], false, false);
@@ -3430,7 +3666,7 @@ namespace TR {
                     ASSERT(d.x0 < 256 && d.x1 < 256 && d.x2 < 256 && d.x3 < 256 && d.y0 < 256 && d.y1 < 256 && d.y2 < 256 && d.y3 < 256);\
                 }
 
-            objectTextures = stream.read(objectTexturesCount) ? new ObjectTexture[objectTexturesCount] : NULL;
+            objectTextures = stream.read(objectTexturesCount) ? arena.alloc<ObjectTexture>(objectTexturesCount) : NULL;
             for (int i = 0; i < objectTexturesCount; i++) {
                 ObjectTexture &t = objectTextures[i];
                 switch (version) {
@@ -3482,7 +3718,7 @@ namespace TR {
                     t.b    = d.b;\
                 }
 
-            spriteTextures = stream.read(spriteTexturesCount) ? new SpriteTexture[spriteTexturesCount] : NULL;
+            spriteTextures = stream.read(spriteTexturesCount) ? arena.alloc<SpriteTexture>(spriteTexturesCount) : NULL;
             for (int i = 0; i < spriteTexturesCount; i++) {
                 SpriteTexture &t = spriteTextures[i];
                 switch (version) {
@@ -3522,7 +3758,7 @@ namespace TR {
 
             #undef SET_PARAMS
 
-            spriteSequences = stream.read(spriteSequencesCount) ? new SpriteSequence[spriteSequencesCount] : NULL;
+            spriteSequences = stream.read(spriteSequencesCount) ? arena.alloc<SpriteSequence>(spriteSequencesCount) : NULL;
             for (int i = 0; i < spriteSequencesCount; i++) {
                 SpriteSequence &s = spriteSequences[i];
                 uint16 type;
@@ -3535,6 +3771,117 @@ namespace TR {
             }
         }
 
+        void initPortals() {
+            portalInfosCount = portalsMax = 0;
+            for (int i = 0; i < roomsCount; i++) {
+                portalInfosCount += rooms[i].portalsCount;
+                portalsMax = max(portalsMax, int32(rooms[i].portalsCount));
+            }
+
+            portalInfos = arena.alloc<PortalInfo>(portalInfosCount);
+            roomPortals = arena.alloc<int32>(roomsCount);
+
+            PortalInfo *info = portalInfos;
+            for (int i = 0; i < roomsCount; i++) {
+                Room &room = rooms[i];
+                vec3 offset = room.getOffset();
+
+                roomPortals[i] = int32(info - portalInfos);
+                for (int j = 0; j < room.portalsCount; j++, info++) {
+                    Room::Portal &p = room.portals[j];
+                    for (int k = 0; k < 4; k++) {
+                        vec3 v = offset + p.vertices[k];
+                        info->x[k] = v.x;
+                        info->y[k] = v.y;
+                        info->z[k] = v.z;
+                    }
+                    info->normal    = p.normal;
+                    info->dist      = info->normal.dot(vec3(info->x[0], info->y[0], info->z[0]));
+                    info->roomIndex = p.roomIndex;
+                }
+            }
+        }
+
+    // conservative room to room visibility: rooms reachable through a chain of portals where every
+    // next portal has at least one vertex behind the plane of the previous one (see Level::getVisibleRooms)
+        void initPVS() {
+            pvsStride = (roomsCount + 31) / 32;
+
+            int32  *owner = new int32[portalInfosCount];
+            int32  *depth = new int32[portalInfosCount];
+            int32  *queue = new int32[portalInfosCount];
+
+            for (int i = 0; i < roomsCount; i++)
+                for (int j = 0; j < rooms[i].portalsCount; j++)
+                    owner[roomPortals[i] + j] = i;
+
+            int count = 0;
+            for (int flip = 0; flip < 2; flip++) {
+                pvs[flip] = arena.alloc<uint32>(pvsStride * roomsCount);
+                memset(pvs[flip], 0, pvsStride * roomsCount * sizeof(uint32));
+
+                for (int from = 0; from < roomsCount; from++) {
+                    uint32 *row = pvs[flip] + from * pvsStride;
+                    row[from / 32] |= 1 << (from % 32);
+
+                    for (int i = 0; i < portalInfosCount; i++)
+                        depth[i] = -1;
+
+                    int head = 0, tail = 0;
+                    for (int i = 0; i < rooms[from].portalsCount; i++) {
+                        int index = roomPortals[from] + i;
+                        depth[index]  = 1;
+                        queue[tail++] = index;
+                    }
+
+                    while (head < tail) {
+                        int index = queue[head++];
+                        const PortalInfo &p = portalInfos[index];
+
+                        int to = getRoomIndex(p.roomIndex, flip);
+                        row[to / 32] |= 1 << (to % 32);
+
+                        if (depth[index] >= MAX_PORTAL_DEPTH)
+                            continue;
+
+                        for (int i = 0; i < rooms[to].portalsCount; i++) {
+                            int next = roomPortals[to] + i;
+                            const PortalInfo &n = portalInfos[next];
+
+                            if (depth[next] != -1 || n.roomIndex == owner[index])
+                                continue;
+
+                            bool behind = false;
+                            for (int k = 0; k < 4 && !behind; k++)
+                                behind = p.normal.dot(vec3(n.x[k], n.y[k], n.z[k])) - p.dist < 0.0f;
+
+                            if (behind) {
+                                depth[next]   = depth[index] + 1;
+                                queue[tail++] = next;
+                            }
+                        }
+                    }
+
+                    for (int i = 0; i < roomsCount; i++)
+                        count += (row[i / 32] >> (i % 32)) & 1;
+                }
+            }
+
+            delete[] owner;
+            delete[] depth;
+            delete[] queue;
+
+            LOG("PVS: %.1f rooms per room\n", roomsCount ? count * 0.5f / roomsCount : 0.0f);
+        }
+
+        int getRoomIndex(int index, int flip) const {
+            return (flip && rooms[index].alternateRoom > -1) ? rooms[index].alternateRoom : index;
+        }
+
+        bool isPotentiallyVisible(int flip, int from, int to) const {
+            return (pvs[flip][from * pvsStride + to / 32] >> (to % 32)) & 1;
+        }
+
         void initRoomMeshes() {
             for (int i = 0; i < roomsCount; i++) {
                 Room &room = rooms[i];
@@ -3543,72 +3890,153 @@ namespace TR {
             }
         }
 
+    // tile conversion kernels (branch-free, shared by loader and tools)
+        static void convertTile8(Tile32 &dst, const Tile8 &src, const uint32 *lut) {
+            uint32      *d = (uint32*)dst.color;
+            const uint8 *s = src.index;
+            for (int i = 0; i < 256 * 256; i += 4) {
+                d[i + 0] = lut[s[i + 0]];
+                d[i + 1] = lut[s[i + 1]];
+                d[i + 2] = lut[s[i + 2]];
+                d[i + 3] = lut[s[i + 3]];
+            }
+        }
+
+        static inline uint32 convertColor16BGR(uint32 v) {
+            uint32 r = (v >> 10) & 31;
+            uint32 g = (v >> 5)  & 31;
+            uint32 b =  v        & 31;
+            r = (r << 3) | (r >> 2);
+            g = (g << 3) | (g >> 2);
+            b = (b << 3) | (b >> 2);
+            return r | (g << 8) | (b << 16) | ((0 - (v >> 15)) << 24);
+        }
+
+        static void convertTile16(Tile32 &dst, const Tile16 &src) {
+            uint32       *d = (uint32*)dst.color;
+            const uint16 *s = (const uint16*)src.color;
+            int i = 0;
+        #ifdef __SSE2__
+            const __m128i zero  = _mm_setzero_si128();
+            const __m128i mask  = _mm_set1_epi32(31);
+            const __m128i alpha = _mm_set1_epi32(0xFF000000);
+
+            #define EXPAND_5551(p) {\
+                __m128i r = _mm_and_si128(_mm_srli_epi32(p, 10), mask);\
+                __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5),  mask);\
+                __m128i b = _mm_and_si128(p, mask);\
+                __m128i a = _mm_and_si128(_mm_srai_epi32(_mm_slli_epi32(p, 16), 31), alpha);\
+                r = _mm_or_si128(_mm_slli_epi32(r, 3), _mm_srli_epi32(r, 2));\
+                g = _mm_or_si128(_mm_slli_epi32(g, 3), _mm_srli_epi32(g, 2));\
+                b = _mm_or_si128(_mm_slli_epi32(b, 3), _mm_srli_epi32(b, 2));\
+                p = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), a));\
+            }
+
+            for (; i < 256 * 256; i += 8) {
+                __m128i v  = _mm_loadu_si128((const __m128i*)(s + i));
+                __m128i lo = _mm_unpacklo_epi16(v, zero);
+                __m128i hi = _mm_unpackhi_epi16(v, zero);
+                EXPAND_5551(lo);
+                EXPAND_5551(hi);
+                _mm_storeu_si128((__m128i*)(d + i + 0), lo);
+                _mm_storeu_si128((__m128i*)(d + i + 4), hi);
+            }
+
+            #undef EXPAND_5551
+        #endif
+            for (; i < 256 * 256; i++)
+                d[i] = convertColor16BGR(s[i]);
+        }
+
+        static void convertRow4(Color32 *dst, const uint8 *src, const uint32 *lut, int minX, int maxX) {
+            uint32 *d = (uint32*)dst;
+            int x = minX;
+            if (x & 1) {
+                d[x] = lut[src[x >> 1] >> 4];
+                x++;
+            }
+            for (; x < maxX; x += 2) {
+                uint8 i = src[x >> 1];
+                d[x + 0] = lut[i & 15];
+                d[x + 1] = lut[i >> 4];
+            }
+            if (x == maxX)
+                d[x] = lut[src[x >> 1] & 15];
+        }
+
+        static void convertRect4(Tile32 &dst, const Tile4 &src, const CLUT &clut, int minX, int minY, int maxX, int maxY) {
+            uint32 lut[16];
+            for (int i = 0; i < 16; i++) {
+                Color32 c = clut.color[i];
+                lut[i] = *(uint32*)&c;
+            }
+            for (int y = minY; y <= maxY; y++)
+                convertRow4(dst.color + y * 256, (uint8*)src.index + y * 128, lut, minX, maxX);
+        }
+
+        void getPaletteLUT(uint32 *lut) const {
+            lut[0] = 0;
+            for (int i = 1; i < 256; i++) {
+                const Color24 &p = palette[i];
+                lut[i] = p.r | (p.g << 8) | (p.b << 16) | 0xFF000000;
+            }
+        }
+
+        struct TilesJob {
+            Level  *level;
+            uint32 lut[256];
+        };
+
+        static void convertTiles8Job(void *userData, int start, int end) {
+            TilesJob *job = (TilesJob*)userData;
+            for (int i = start; i < end; i++)
+                convertTile8(job->level->tiles[i], job->level->tiles8[i], job->lut);
+        }
+
+        static void convertTiles16Job(void *userData, int start, int end) {
+            TilesJob *job = (TilesJob*)userData;
+            for (int i = start; i < end; i++)
+                convertTile16(job->level->tiles[i], job->level->tiles16[i]);
+        }
+
         void initTiles() {
             tiles = new Tile32[tilesCount];
         // convert to RGBA
+            TilesJob job;
+            job.level = this;
+
             switch (version) {
                 case VER_TR1_PC : {
                     ASSERT(tiles8);
                     ASSERT(palette);
 
-                    for (int i = 0; i < 256; i++) { // Amiga -> PC color palette
-                        Color24 &c = palette[i];
-                        c.r <<= 2;
-                        c.g <<= 2;
-                        c.b <<= 2;
-                    }
-
-                    for (int i = 0; i < tilesCount; i++) {
-                        Color32 *ptr = &tiles[i].color[0];
-                        for (int y = 0; y < 256; y++) {
-                            for (int x = 0; x < 256; x++) {
-                                uint8 index = tiles8[i].index[y * 256 + x];
-                                Color24 &p = palette[index];
-                                if (index != 0) {
-                                    ptr[x].r = p.r;
-                                    ptr[x].g = p.g;
-                                    ptr[x].b = p.b;
-                                    ptr[x].a = 255;
-                                } else
-                                    ptr[x].r = ptr[x].g = ptr[x].b = ptr[x].a = 0;
-                            }
-                            ptr += 256;
-                        }
-                    }
+                    getPaletteLUT(job.lut);
+                    parallelFor(tilesCount, convertTiles8Job, &job);
                     break;
                 }
                 case VER_TR1_PSX :
                 case VER_TR2_PSX : {
                     ASSERT(tiles4);
                     ASSERT(cluts);
-
+                // texture rects may overlap with different CLUTs, keep the original order
                     for (int i = 0; i < objectTexturesCount; i++) {
                         ObjectTexture &t = objectTextures[i];
-                        CLUT   &clut = cluts[t.clut];
-                        Tile32 &dst  = tiles[t.tile.index];
-                        Tile4  &src  = tiles4[t.tile.index];
 
                         int minX = min(min(t.texCoord[0].x, t.texCoord[1].x), t.texCoord[2].x);
                         int maxX = max(max(t.texCoord[0].x, t.texCoord[1].x), t.texCoord[2].x);
                         int minY = min(min(t.texCoord[0].y, t.texCoord[1].y), t.texCoord[2].y);
                         int maxY = max(max(t.texCoord[0].y, t.texCoord[1].y), t.texCoord[2].y);
 
-                        for (int y = minY; y <= maxY; y++)
-                            for (int x = minX; x <= maxX; x++)
-                                dst.color[y * 256 + x] = clut.color[(x % 2) ? src.index[(y * 256 + x) / 2].b : src.index[(y * 256 + x) / 2].a];
+                        convertRect4(tiles[t.tile.index], tiles4[t.tile.index], cluts[t.clut], minX, minY, maxX, maxY);
                     }
 
                     for (int i = 0; i < spriteTexturesCount; i++) {
                         SpriteTexture &t = spriteTextures[i];
-                        CLUT   &clut = cluts[t.clut];
-                        Tile32 &dst  = tiles[t.tile];
-                        Tile4  &src  = tiles4[t.tile];
-                        
-                        for (int y = t.texCoord[0].y; y <= t.texCoord[1].y; y++)
-                            for (int x = t.texCoord[0].x; x <= t.texCoord[1].x; x += 2) {                           
-                                dst.color[y * 256 + x + 0] = clut.color[src.index[(y * 256 + x) / 2].a];
-                                dst.color[y * 256 + x + 1] = clut.color[src.index[(y * 256 + x) / 2].b];
-                            }
+
+                        int minX = t.texCoord[0].x;
+                        int maxX = minX + (t.texCoord[1].x - minX) / 2 * 2 + 1; // pixel pairs
+
+                        convertRect4(tiles[t.tile], tiles4[t.tile], cluts[t.clut], minX, t.texCoord[0].y, maxX, t.texCoord[1].y);
                     }
 
                     break;
@@ -3617,19 +4045,7 @@ namespace TR {
                 case VER_TR3_PC : {
                     ASSERT(tiles16);
 
-                    for (int i = 0; i < tilesCount; i++) {
-                        Color32 *ptr = &tiles[i].color[0];
-                        for (int y = 0; y < 256; y++) {
-                            for (int x = 0; x < 256; x++) {
-                                Color32 c = tiles16[i].color[y * 256 + x];
-                                ptr[x].r = c.b;
-                                ptr[x].g = c.g;
-                                ptr[x].b = c.r;
-                                ptr[x].a = c.a;
-                            }
-                            ptr += 256;
-                        }
-                    }
+                    parallelFor(tilesCount, convertTiles16Job, &job);
                     break;
                 }
                 default : ASSERT(false);
@@ -3641,6 +4057,34 @@ namespace TR {
             tiles16 = NULL;
         }
 
+    // CPU side texture data (the source of atlas or tile textures)
+        int getTextureDataSize() const {
+            int size = 0;
+            if (tiles)     size += tilesCount * sizeof(Tile32);
+            if (tiles4)    size += tilesCount * sizeof(Tile4);
+            if (tiles8)    size += tilesCount * sizeof(Tile8);
+            if (tiles16)   size += tilesCount * sizeof(Tile16);
+            if (cluts)     size += clutsCount * sizeof(CLUT);
+            if (palette)   size += 256 * sizeof(Color24);
+            if (palette32) size += 256 * sizeof(Color32);
+            return size;
+        }
+
+    // release the PSX tiles & CLUTs after upload, getColor keeps working from the per-texture color table
+        void compactTextures() {
+            if (!tiles4) return;
+
+            if (!palette32)
+                palette32 = arena.alloc<Color32>(256);
+            for (int i = 0; i < 256; i++)
+                palette32[i] = i < objectTexturesCount ? getColor(i) : Color32(255, 0, 255, 255);
+
+            delete[] tiles4;
+            delete[] cluts;
+            tiles4 = NULL;
+            cluts  = NULL;
+        }
+
     // common methods
         Color32 getColor(int texture) const {
             switch (version) {
@@ -3650,6 +4094,7 @@ namespace TR {
                 case VER_TR1_PSX : 
                 case VER_TR2_PSX : {
                     ASSERT((texture & 0x7FFF) < 256);
+                    if (!tiles4) return palette32[texture & 0xFF]; // compacted
                     ObjectTexture &t = objectTextures[texture & 0x7FFF];
                     int idx  = (t.texCoord[0].y * 256 + t.texCoord[0].x) / 2;
                     int part = t.texCoord[0].x % 2;
@@ -3,15 +3,20 @@
 
 #include "utils.h"
 
-#define MAX_CLIP_PLANES 16
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#define MAX_CLIP_PLANES 8 // multiple of 4 for SIMD (unused planes always pass)
 
 struct Frustum {
     vec3 pos;
-    vec4 planes[MAX_CLIP_PLANES * 2];   // + buffer for OBB visibility test
-    int  start, count;
+    vec4 planes[MAX_CLIP_PLANES];
+    int  count;
+// planes in SoA layout for the box tests
+    float nx[MAX_CLIP_PLANES], ny[MAX_CLIP_PLANES], nz[MAX_CLIP_PLANES], nw[MAX_CLIP_PLANES];
 
     void calcPlanes(const mat4 &m) {
-        start = 0;
         count = 5;
         planes[0] = vec4(m.e30 - m.e20, m.e31 - m.e21, m.e32 - m.e22, m.e33 - m.e23); // near
         planes[1] = vec4(m.e30 - m.e10, m.e31 - m.e11, m.e32 - m.e12, m.e33 - m.e13); // top
@@ -20,43 +25,75 @@ struct Frustum {
         planes[4] = vec4(m.e30 + m.e00, m.e31 + m.e01, m.e32 + m.e02, m.e33 + m.e03); // left
         for (int i = 0; i < count; i++)
             planes[i] *= 1.0f / planes[i].xyz().length();
+
+        for (int i = 0; i < MAX_CLIP_PLANES; i++) {
+            vec4 p = i < count ? planes[i] : vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            nx[i] = p.x;
+            ny[i] = p.y;
+            nz[i] = p.z;
+            nw[i] = p.w;
+        }
     }
 
-    // AABB visibility check
-    bool isVisible(const vec3 &min, const vec3 &max) const {
+    // box given by the center and half-size axes is outside if it is behind any plane by more than its projected radius
+    // (equals to the n-vertex test for AABB)
+    bool isVisible(const vec3 &c, const vec3 &ax, const vec3 &ay, const vec3 &az) const {
         if (count < 4) return false;
 
-        for (int i = start; i < start + count; i++) {
-            const vec3 &n =  planes[i].xyz();
-            const float d = -planes[i].w;
-
-            if (n.dot(max) < d && 
-                n.dot(min) < d &&
-                n.dot(vec3(min.x, max.y, max.z)) < d &&
-                n.dot(vec3(max.x, min.y, max.z)) < d &&
-                n.dot(vec3(min.x, min.y, max.z)) < d &&
-                n.dot(vec3(max.x, max.y, min.z)) < d &&
-                n.dot(vec3(min.x, max.y, min.z)) < d &&
-                n.dot(vec3(max.x, min.y, min.z)) < d)
+    #ifdef __SSE2__
+        const __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+        #define DOT(x, y, z) _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(x)), _mm_mul_ps(py, _mm_set1_ps(y))), _mm_mul_ps(pz, _mm_set1_ps(z)))
+
+        for (int i = 0; i < MAX_CLIP_PLANES; i += 4) {
+            __m128 px = _mm_loadu_ps(nx + i);
+            __m128 py = _mm_loadu_ps(ny + i);
+            __m128 pz = _mm_loadu_ps(nz + i);
+
+            __m128 d = _mm_add_ps(DOT(c.x, c.y, c.z), _mm_loadu_ps(nw + i));
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_and_ps(DOT(ax.x, ax.y, ax.z), sign),
+                                             _mm_and_ps(DOT(ay.x, ay.y, ay.z), sign)),
+                                             _mm_and_ps(DOT(az.x, az.y, az.z), sign));
+
+            if (_mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps())))
                 return false;
         }
-        return true;
-    }
 
-    // OBB visibility check
-    bool isVisible(const mat4 &matrix, const vec3 &min, const vec3 &max) {
-        start = count;
-        // transform clip planes (relative)
-        mat4 m = matrix.inverse();
+        #undef DOT
+    #else
         for (int i = 0; i < count; i++) {
-            vec4 &p = planes[i];
-            vec4 o = m * vec4(p.xyz() * (-p.w), 1.0f);
-            vec4 n = m * vec4(p.xyz(), 0.0f);
-            planes[start + i] = vec4(n.xyz(), -n.xyz().dot(o.xyz()));
+            const vec3 &n = planes[i].xyz();
+            float r = fabsf(n.dot(ax)) + fabsf(n.dot(ay)) + fabsf(n.dot(az));
+            if (n.dot(c) + planes[i].w + r < 0.0f)
+                return false;
         }
-        bool visible = isVisible(min, max);
-        start = 0;
-        return visible;
+    #endif
+        return true;
+    }
+
+    // AABB visibility check
+    bool isVisible(const vec3 &min, const vec3 &max) const {
+        vec3 e = (max - min) * 0.5f;
+        return isVisible((max + min) * 0.5f, vec3(e.x, 0.0f, 0.0f), vec3(0.0f, e.y, 0.0f), vec3(0.0f, 0.0f, e.z));
+    }
+
+    // OBB visibility check (box in the matrix space)
+    bool isVisible(const mat4 &matrix, const vec3 &min, const vec3 &max) const {
+        vec3 e = (max - min) * 0.5f;
+        vec3 c = (matrix * vec4((max + min) * 0.5f, 1.0f)).xyz();
+        return isVisible(c, matrix.right().xyz() * e.x, matrix.up().xyz() * e.y, matrix.dir().xyz() * e.z);
+    }
+
+    // batched AABB visibility check
+    void isVisible(const Box *boxes, bool *visible, int count) const {
+        for (int i = 0; i < count; i++)
+            visible[i] = isVisible(boxes[i].min, boxes[i].max);
+    }
+
+    // batched OBB visibility check
+    void isVisible(const mat4 *matrices, const Box *boxes, bool *visible, int count) const {
+        for (int i = 0; i < count; i++)
+            visible[i] = isVisible(matrices[i], boxes[i].min, boxes[i].max);
     }
 
     // Sphere visibility check
@@ -71,4 +108,4 @@ struct Frustum {
 
 };
 
-#endif
\ No newline at end of file
+#endif
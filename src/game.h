@@ -7,11 +7,54 @@
 #include "level.h"
 #include "ui.h"
 
+#define TICK_RATE 60 // simulation ticks per second, the frames in between are interpolated (see Game::update)
+
 ShaderCache *shaderCache;
 
 namespace Game {
     Level  *level;
-    Stream *nextLevel;
+    Level  *nextLevel;  // parsed by the loader thread, waits for init on the main thread
+    void   *loadThread;
+    Mutex  *loadLock;
+
+#ifdef USE_MMAP
+    const char *loadBackend = "mmap";
+#else
+    const char *loadBackend = "fread";
+#endif
+
+    void* loadProc(void *arg) {
+        Stream *lvl = (Stream*)arg;
+
+        LOAD_PROFILE_BEGIN(lvl->name);
+        int startTime = Core::getTime();
+        Level *next = new Level(*lvl);
+        LOG("level parsed in %d ms (%s, loader thread)\n", Core::getTime() - startTime, loadBackend);
+        delete lvl;
+
+        OS_LOCK(*loadLock);
+        nextLevel = next;
+        return NULL;
+    }
+
+    void swapLevel(Level *next) {
+        int startTime = Core::getTime();
+        delete level;
+        level = next;
+        level->init();
+        UI::game = level;
+        LOG("level init in %d ms (main thread)\n", Core::getTime() - startTime);
+        LOAD_PROFILE_SAVE();
+    }
+
+    void startLevel(Stream *lvl) {
+        LOAD_PROFILE_BEGIN(lvl->name);
+        int startTime = Core::getTime();
+        Level *next = new Level(*lvl);
+        delete lvl;
+        swapLevel(next);
+        LOG("level loaded in %d ms (%s)\n", Core::getTime() - startTime, loadBackend);
+    }
 }
 
 void loadAsync(Stream *stream, void *userData) {
@@ -19,15 +62,33 @@ void loadAsync(Stream *stream, void *userData) {
         if (Game::level) Game::level->isEnded = false;
         return;
     }
-    Game::nextLevel = stream;
+    bool busy;
+    {
+        OS_LOCK(*Game::loadLock);
+        busy = Game::loadThread || Game::nextLevel;
+    }
+    if (busy) { // one level at a time, the old and the loaded one are already resident together
+        LOG("! level is loading already, request rejected\n");
+        delete stream;
+        return;
+    }
+    Game::loadThread = osThreadCreate(Game::loadProc, stream);
 }
 
 namespace Game {
-    void startLevel(Stream *lvl) {
-        delete level;
-        level = new Level(*lvl);
-        UI::game = level;
-        delete lvl;
+    Level* getLoadedLevel() {
+        Level *next;
+        {
+            OS_LOCK(*loadLock);
+            next = nextLevel;
+            nextLevel = NULL;
+        }
+
+        if (next && loadThread) {
+            osThreadJoin(loadThread);
+            loadThread = NULL;
+        }
+        return next;
     }
 
     void stopChannel(Sound::Sample *channel) {
@@ -35,10 +96,17 @@ namespace Game {
     }
 
     void init(Stream *lvl) {
-        nextLevel = NULL;
+        nextLevel  = NULL;
+        loadThread = NULL;
+        loadLock   = new Mutex();
 
         Core::init();
-        shaderCache = new ShaderCache();
+
+        LOAD_PROFILE_BEGIN("startup");
+        {
+            LOAD_PHASE("shaders");
+            shaderCache = new ShaderCache();
+        }
 
         UI::init(level);
 
@@ -67,6 +135,10 @@ namespace Game {
         #ifdef _DEBUG
             Debug::deinit();
         #endif
+        if (loadThread)
+            osThreadJoin(loadThread);
+        delete nextLevel;
+        delete loadLock;
         delete level;
         UI::deinit();
         delete shaderCache;
@@ -95,10 +167,9 @@ namespace Game {
 
         float delta = Core::deltaTime;
 
-        if (nextLevel) {
-            startLevel(nextLevel);
-            nextLevel = NULL;
-        }
+        Level *next = getLoadedLevel();
+        if (next)
+            swapLevel(next);
 
         if (level->isEnded)
             return true;
@@ -131,14 +202,37 @@ namespace Game {
         if (!level->level.isCutsceneLevel())
             delta = min(0.2f, delta);
 
-        while (delta > EPS) {
-            Core::deltaTime = min(delta, 1.0f / 30.0f);
-            Game::updateTick();
-            delta -= Core::deltaTime;
-            if (Core::resetState) // resetTime was called
-                break;
+        double time = getPreciseTime();
+        int ticks = level->tickIndex;
+
+        if (level->isFixedTick()) {
+            level->tickTime += delta;
+            while (level->tickTime >= 1.0f / TICK_RATE) {
+                Core::deltaTime = 1.0f / TICK_RATE;
+                Game::updateTick();
+                level->tickTime -= 1.0f / TICK_RATE;
+                if (Core::resetState || level->isEnded || !level->isFixedTick()) { // resetTime was called or the game is paused
+                    level->tickTime = 0.0f;
+                    break;
+                }
+            }
+            level->tickAlpha = level->tickTime * TICK_RATE;
+            Core::deltaTime  = delta;
+        } else {
+            while (delta > EPS) {
+                Core::deltaTime = min(delta, 1.0f / 30.0f);
+                Game::updateTick();
+                delta -= Core::deltaTime;
+                if (Core::resetState) // resetTime was called
+                    break;
+            }
+            level->tickTime  = 0.0f;
+            level->tickAlpha = 1.0f;
         }
 
+        Core::stats.ticks    += level->tickIndex - ticks;
+        Core::stats.tickTime += float(getPreciseTime() - time);
+
         return true;
     }
 
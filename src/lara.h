@@ -1664,7 +1664,7 @@ struct Lara : Character {
 
         pickupListCount = 0;
 
-        for (int i = 0; i < level->entitiesCount; i++) {
+        for (int i = game->getRoomEntity(room); i > -1; i = game->getNextRoomEntity(i)) {
             TR::Entity &entity = level->entities[i];
             if (!entity.controller || !entity.isPickup())
                 continue;
@@ -3240,6 +3240,18 @@ struct Lara : Character {
         mesh->renderModel(level->extra.muzzleFlash);
     }
 
+    virtual bool canInstance() const {
+        return false;
+    }
+
+    virtual uint32 getShadowHash(uint32 hash) {
+        hash = Controller::getShadowHash(hash);
+        hash = fnv32((const char*)&state, sizeof(state), hash);
+        if (braid)
+            hash = fnv32((const char*)braid->basis, sizeof(Basis) * (braid->jointsCount - 1), hash);
+        return hash;
+    }
+
     virtual void render(Frustum *frustum, MeshBuilder *mesh, Shader::Type type, bool caustics) {
         uint32 visMask = visibleMask;
         if (Core::pass != Core::passShadow && camera->firstPerson && camera->viewIndex == -1) // hide head in first person view // TODO: fix for firstPerson with viewIndex always == -1
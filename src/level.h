@@ -15,6 +15,8 @@
     #include "debug.h"
 #endif
 
+#define UPDATE_JOB_MIN 32 // fewer controllers are prepared and posed on the calling thread, waking the job pool costs more (see updateControllers)
+
 extern ShaderCache *shaderCache;
 extern void loadAsync(Stream *stream, void *userData);
 
@@ -25,6 +27,10 @@ struct Level : IGame {
     Texture     *cube;
     MeshBuilder *mesh;
 
+    uint32      *atlasPixels; // packed atlas waiting for upload
+    int         atlasWidth, atlasHeight;
+    TR::ObjectTexture barTiles[UI::BAR_MAX]; // atlas tiles of the UI bars, copied to barTile on the main thread (see init)
+
     Lara        *players[2], *player;
     Camera      *camera;
     Texture     *shadow;
@@ -39,6 +45,7 @@ struct Level : IGame {
     ZoneCache    *zoneCache;
     AmbientCache *ambientCache;
     WaterCache   *waterCache;
+    TrackCache   *trackCache;
 
     Sound::Sample *sndSoundtrack;
     Sound::Sample *sndUnderwater;
@@ -55,6 +62,62 @@ struct Level : IGame {
 
     Texture    *cube360;
 
+    enum DrawType  { DRAW_ROOM, DRAW_ROOM_SPRITES, DRAW_ENTITY, DRAW_SHADOW };
+    enum DrawLayer { LAYER_OPAQUE, LAYER_ALPHA, LAYER_SHADOW, LAYER_ADD };
+
+    struct DrawItem {
+        uint64 key;
+        uint8  type;
+        uint8  layer;
+        uint16 index;
+
+        static int cmp(const DrawItem &a, const DrawItem &b) {
+            return a.key < b.key ? -1 : (a.key > b.key ? 1 : 0);
+        }
+    } *drawList;    // see renderView
+    int  drawCount, drawCapacity;
+    bool sortDraws;
+    bool instancing;
+    bool sharedViews;
+    int  viewsOpen;  // culled views that are not released yet, nested views (water reflection) append to the draw list
+    float viewRadius; // max distance from viewPos to the eyes of the shared view (see setupSharedView)
+
+    bool   parallelUpdate;   // read phase and poses of the controllers by jobs, serial reference tick if off (see updateControllers)
+
+    int    frameIndex;       // rendered game frames, unlike Core::stats.frame never wraps
+    int    tickIndex;        // simulation ticks done
+    float  tickTime;         // time since the last fixed tick (see Game::update)
+    float  tickAlpha;        // rendered state between the two last ticks (0..1)
+
+    bool   shadowCache;      // skip the shadow pass while the light and casters are unchanged (see renderShadows)
+    bool   shadowValid;
+    uint32 shadowHash;
+    int    shadowDips;       // cost of the last rendered shadow pass
+    float  shadowTime;
+
+    struct ViewList {
+        int  roomsList[256];
+        int  roomsCount;
+        int  drawFirst, drawLast;
+        bool hasSky;
+    };
+    Basis instanceBasis[32]; // see renderEntityInstances
+
+    struct PortalNode {
+        int  from, to, depth;
+        vec4 viewPort;
+    } *portalStack; // see getVisibleRooms
+    vec4 *roomPorts;  // union of the portal windows the room is seen through
+    vec4 *roomClip;   // portal window of the room objects (includes windows of the adjacent visible rooms)
+    Frustum viewFrustum; // frustum of the current view (see renderView)
+
+// per-room entity lists, the last bucket holds entities rendered regardless of room visibility (see updateRoomEntities)
+    int *roomEntities; // first entity index of the bucket or -1
+    int *entityNext;   // next entity index in the same bucket or -1
+    int *entityBucket; // current bucket of the entity or -1
+    bool *entityClipped; // entity is out of its room portal window in the current view
+    Controller **poseList; // models to pose in the current view (see updatePoses)
+
 // IGame implementation ========
     virtual void loadLevel(TR::LevelID id) {
         if (isEnded) return;
@@ -189,6 +252,8 @@ struct Level : IGame {
 
         delete[] data;
 
+        updateRoomEntities();
+
     //    camera->room = lara->getRoomIndex();
     //    camera->pos  = camera->destPos = lara->pos;
         LOG("Ok\n");
@@ -240,7 +305,7 @@ struct Level : IGame {
 
         if (rebuildMesh) {
             delete mesh;
-            mesh = new MeshBuilder(level, atlas);
+            mesh = new MeshBuilder(level, barTiles[UI::BAR_WHITE], atlas);
         }
 
         if (rebuildAmbient) {
@@ -249,6 +314,7 @@ struct Level : IGame {
         }
 
         if (rebuildShadows) {
+            shadowValid = false;
             delete shadow;
             shadow = Core::settings.detail.shadows > Core::Settings::LOW ? new Texture(SHADOW_TEX_SIZE, SHADOW_TEX_SIZE, Texture::SHADOW, false) : NULL;
         }
@@ -292,6 +358,10 @@ struct Level : IGame {
         return (players[0]->pos - pos).length2() < (players[1]->pos - pos).length2() ? players[0] : players[1];
     }
 
+    virtual int getTickIndex() {
+        return tickIndex;
+    }
+
     virtual bool isCutscene() {
         if (level.isTitle()) return false;
         return camera->mode == Camera::MODE_CUTSCENE;
@@ -450,6 +520,7 @@ struct Level : IGame {
 
         Controller *controller = initController(index);
         e.controller = controller;
+        linkEntity(index, getEntityBucket(e));
 
         if (e.isEnemy() || e.isSprite()) {
             controller->flags.active = TR::ACTIVE;
@@ -460,10 +531,59 @@ struct Level : IGame {
     }
 
     virtual void removeEntity(Controller *controller) {
+        linkEntity(controller->entity, -1);
         level.entities[controller->entity].controller = NULL;
         delete controller;
     }
 
+    virtual int getRoomEntity(int roomIndex) {
+        return roomEntities[roomIndex];
+    }
+
+    virtual int getNextRoomEntity(int entityIndex) {
+        return entityNext[entityIndex];
+    }
+
+    int getEntityBucket(const TR::Entity &e) {
+        Controller *controller = (Controller*)e.controller;
+        if (!controller)
+            return -1;
+        if (e.isLara() || e.isActor())
+            return level.roomsCount;
+        return controller->getRoomIndex();
+    }
+
+// move entity into the bucket, entities are kept sorted by index to preserve the original order
+    void linkEntity(int index, int bucket) {
+        int &current = entityBucket[index];
+        if (current == bucket)
+            return;
+
+        if (current > -1) {
+            int *ptr = &roomEntities[current];
+            while (*ptr != index)
+                ptr = &entityNext[*ptr];
+            *ptr = entityNext[index];
+            entityNext[index] = -1;
+        }
+
+        current = bucket;
+
+        if (bucket > -1) {
+            int *ptr = &roomEntities[bucket];
+            while (*ptr > -1 && *ptr < index)
+                ptr = &entityNext[*ptr];
+            entityNext[index] = *ptr;
+            *ptr = index;
+        }
+    }
+
+// relink entities whose (flip resolved) room index has changed since the last call
+    void updateRoomEntities() {
+        for (int i = 0; i < level.entitiesCount; i++)
+            linkEntity(i, getEntityBucket(level.entities[i]));
+    }
+
     virtual bool invUse(int playerIndex, TR::Entity::Type type) {
         if (!players[playerIndex]->useItem(type))
             return inventory.use(type);
@@ -509,7 +629,14 @@ struct Level : IGame {
             }
             if (b.flags.gain) volume = max(0.0f, volume - randf() * 0.25f);
             //if (b.flags.camera) flags &= ~Sound::PAN;
-            return Sound::play(level.getSampleStream(index), pos, volume, pitch, flags, id);
+            Sound::Sample *channel;
+            if (!Sound::prepare(pos, volume, pitch, flags, id, channel))
+                return channel;
+
+            Sound::Decoder *decoder = Sound::cache.get(index);
+            if (!decoder)
+                decoder = Sound::cache.add(index, level.getSampleStream(index));
+            return Sound::play(decoder, pos, volume, pitch, flags, id);
         }
         return NULL;
     }
@@ -523,22 +650,24 @@ struct Level : IGame {
         }
     }
 
-    static void playAsync(Stream *stream, void *userData) {
-        if (!stream) return;
-        Level *level = (Level*)userData;
-
-        level->sndSoundtrack = Sound::play(stream, vec3(0.0f), 0.01f, 1.0f, Sound::MUSIC);
-        if (level->sndSoundtrack) {
-            if (level->level.isCutsceneLevel()) {
-            //    level->sndSoundtrack->setVolume(0.0f, 0.0f);
-            //    level->sndCurrent = level->sndSoundtrack;
+    void startTrack(Sound::Decoder *decoder) {
+        sndSoundtrack = Sound::play(decoder, vec3(0.0f), 0.01f, 1.0f, Sound::MUSIC);
+        if (sndSoundtrack) {
+            if (level.isCutsceneLevel()) {
+            //    sndSoundtrack->setVolume(0.0f, 0.0f);
+            //    sndCurrent = sndSoundtrack;
                 Core::resetTime();
             }
-            level->sndSoundtrack->setVolume(1.0f, 0.2f);
+            sndSoundtrack->setVolume(1.0f, 0.2f);
         }
         LOG("play soundtrack - %d\n", Core::getTime());
     }
 
+    static void playAsync(Stream *stream, void *userData) {
+        if (!stream) return;
+        ((Level*)userData)->startTrack(Sound::openDecoder(stream));
+    }
+
     virtual void playTrack(uint8 track, bool restart = false) {
         if (track == 0)
             track = TR::LEVEL_INFO[level.id].ambientTrack;
@@ -561,7 +690,11 @@ struct Level : IGame {
 
         if (track == 0xFF) return;
 
-        getGameTrack(level.version, track, playAsync, this);
+        Sound::Decoder *decoder = trackCache ? trackCache->getDecoder(track) : NULL;
+        if (decoder)
+            startTrack(decoder);
+        else
+            getGameTrack(level.version, track, playAsync, this);
     }
 
     virtual void stopTrack() {
@@ -569,25 +702,87 @@ struct Level : IGame {
     }
 //==============================
 
-    Level(Stream &stream) : level(stream), inventory(this), isEnded(false), cutsceneWaitTimer(0.0f) {
+// parse level and prepare textures & geometry (CPU only, safe for the loader thread)
+    Level(Stream &stream) : level(stream), inventory(this), atlas(NULL), cube(NULL), atlasPixels(NULL), camera(NULL), shadow(NULL), zoneCache(NULL), ambientCache(NULL), waterCache(NULL), trackCache(NULL), isEnded(false), cutsceneWaitTimer(0.0f), cube360(NULL) {
+        memset(players, 0, sizeof(players));
+        memset((void*)barTiles, 0, sizeof(barTiles));
+        player = NULL;
+
+        portalStack = new PortalNode[MAX_PORTAL_DEPTH * max(level.portalsMax, 1) + 1];
+        roomPorts   = new vec4[level.roomsCount];
+        roomClip    = new vec4[level.roomsCount];
+
+        roomEntities = new int[level.roomsCount + 1];
+        entityNext   = new int[level.entitiesCount];
+        entityBucket = new int[level.entitiesCount];
+        memset(roomEntities, 0xFF, sizeof(int) * (level.roomsCount + 1));
+        memset(entityNext,   0xFF, sizeof(int) * level.entitiesCount);
+        memset(entityBucket, 0xFF, sizeof(int) * level.entitiesCount);
+        entityClipped = new bool[level.entitiesCount];
+        memset(entityClipped, 0, sizeof(bool) * level.entitiesCount);
+        poseList      = new Controller*[level.entitiesCount];
+
+        drawCapacity = (level.roomsCount + level.entitiesCount) * 4 * 2; // main view + nested reflection view
+        drawList     = new DrawItem[drawCapacity];
+        drawCount    = 0;
+        sortDraws    = true;
+        instancing   = true;
+        sharedViews  = true;
+        viewsOpen    = 0;
+        viewRadius   = 0.0f;
+        parallelUpdate = true;
+        frameIndex   = 0;
+        tickIndex    = 0;
+        tickTime     = 0.0f;
+        tickAlpha    = 1.0f;
+        shadowCache  = true;
+        shadowValid  = false;
+        shadowHash   = 0;
+        shadowDips   = 0;
+        shadowTime   = 0.0f;
+
+        {
+            LOAD_PHASE("textures");
+            initTextures();
+        }
+        {
+            LOAD_PHASE("mesh");
+            mesh = new MeshBuilder(level, barTiles[UI::BAR_WHITE]);
+        }
+    }
+
+// upload GPU resources and init entities (main thread)
+    void init() {
     #ifdef _PSP
         Core::freeEDRAM();
     #endif
         params = (Params*)&Core::params;
         params->time = 0.0f;
 
-        memset(players, 0, sizeof(players));
-        player = NULL;
+    // publish the UI bar tiles, the previous level is deleted already (see Game::swapLevel)
+        memcpy(barTile, barTiles, sizeof(barTile));
 
-        initTextures();
-        mesh = new MeshBuilder(level, atlas);
+        {
+            LOAD_PHASE("upload");
+            uploadTextures();
+            mesh->upload(atlas);
+        }
+    #if !defined(_PSP) && !defined(KEEP_TEXTURE_DATA) // PSP textures use the source tiles directly
+        int texDataSize = level.getTextureDataSize();
+        level.compactTextures();
+        LOG("texture data: %d KB -> %d KB\n", texDataSize / 1024, level.getTextureDataSize() / 1024);
+    #endif
         initOverrides();
 
-        for (int i = 0; i < level.entitiesBaseCount; i++) {
-            TR::Entity &e = level.entities[i];
-            e.controller = initController(i);
-            if (e.type == TR::Entity::LARA || ((level.version & TR::VER_TR1) && e.type == TR::Entity::CUT_1))
-                players[0] = (Lara*)e.controller;
+        {
+            LOAD_PHASE("controllers");
+            for (int i = 0; i < level.entitiesBaseCount; i++) {
+                TR::Entity &e = level.entities[i];
+                e.controller = initController(i);
+                if (e.type == TR::Entity::LARA || ((level.version & TR::VER_TR1) && e.type == TR::Entity::CUT_1))
+                    players[0] = (Lara*)e.controller;
+            }
+            updateRoomEntities();
         }
 
         Sound::listenersCount = 1;
@@ -598,10 +793,16 @@ struct Level : IGame {
             camera = player->camera;
 
 
-            zoneCache    = new ZoneCache(this);
-            ambientCache = Core::settings.detail.lighting > Core::Settings::MEDIUM ? new AmbientCache(this) : NULL;
-            waterCache   = Core::settings.detail.water    > Core::Settings::LOW    ? new WaterCache(this)   : NULL;
-            shadow       = Core::settings.detail.shadows  > Core::Settings::LOW    ? new Texture(SHADOW_TEX_SIZE, SHADOW_TEX_SIZE, Texture::SHADOW, false) : NULL;
+            {
+                LOAD_PHASE("caches");
+                zoneCache    = new ZoneCache(this);
+                ambientCache = Core::settings.detail.lighting > Core::Settings::MEDIUM ? new AmbientCache(this) : NULL;
+                waterCache   = Core::settings.detail.water    > Core::Settings::LOW    ? new WaterCache(this)   : NULL;
+            #ifndef __EMSCRIPTEN__ // tracks are downloaded asynchronously anyway
+                trackCache   = new TrackCache(this);
+            #endif
+                shadow       = Core::settings.detail.shadows  > Core::Settings::LOW    ? new Texture(SHADOW_TEX_SIZE, SHADOW_TEX_SIZE, Texture::SHADOW, false) : NULL;
+            }
 
             initReflections();
 
@@ -645,6 +846,16 @@ struct Level : IGame {
     }
 
     virtual ~Level() {
+        delete[] atlasPixels;
+        delete[] portalStack;
+        delete[] roomPorts;
+        delete[] roomClip;
+        delete[] drawList;
+        delete[] roomEntities;
+        delete[] entityNext;
+        delete[] entityBucket;
+        delete[] entityClipped;
+        delete[] poseList;
         delete cube360;
 
         for (int i = 0; i < level.entitiesCount; i++)
@@ -654,12 +865,18 @@ struct Level : IGame {
         delete ambientCache;
         delete waterCache;
         delete zoneCache;
+        delete trackCache;
 
         delete atlas;
         delete cube;
         delete mesh;
 
         Sound::stopAll();
+
+        Sound::Cache::Stats &stats = Sound::cache.stats;
+        LOG("sfx cache: %d hits, %d misses (%d%%), %d evicted, decoded in %.1f ms, saved %.1f ms\n", stats.hits, stats.misses, stats.getHitRate(), stats.evictions, stats.decodeTime, stats.savedTime);
+        Sound::cache.clear();
+        memset(&stats, 0, sizeof(stats));
     }
 
     void addPlayer(int index) {
@@ -848,7 +1065,8 @@ struct Level : IGame {
         int stride = 256, uvCount;
         short2 *uv = NULL;
 
-        TR::Level *level = (TR::Level*)userData;
+        Level     *owner = (Level*)userData;
+        TR::Level *level = &owner->level;
         TR::Color32 *src, *dst = (TR::Color32*)data;
         short4 mm;
 
@@ -881,7 +1099,7 @@ struct Level : IGame {
                     case UI::BAR_OPTION   :
                     case UI::BAR_WHITE    :
                         src  = (TR::Color32*)&barColor[id][0];
-                        tex  = &barTile[id];
+                        tex  = &owner->barTiles[id];
                         if (id != UI::BAR_WHITE) {
                             mm.w = 4; // height - 1
                             if (id == UI::BAR_OPTION) {
@@ -987,23 +1205,20 @@ struct Level : IGame {
         delete[] data;
     }
 */
-    void initTextures() {
-        ASSERT(level.tilesCount);
-
-    #ifndef SPLIT_BY_TILE
-
-        #ifdef _PSP
-            #error atlas packing is not allowed for this platform
-        #endif
-
-        level.initTiles();
+#ifndef SPLIT_BY_TILE
+    void buildAtlas(const char *fileName) {
+        {
+            LOAD_PHASE("tiles");
+            level.initTiles();
+        }
+        LOAD_PHASE("atlas");
 
         //dumpGlyphs();
 
         int texIdx = (level.version & TR::VER_PSX) ? 256 : 0; // skip palette color for PSX version
 
     // repack texture tiles
-        Atlas *tiles = new Atlas(level.objectTexturesCount + level.spriteTexturesCount + UI::BAR_MAX, &level, fillCallback);
+        Atlas *tiles = new Atlas(level.objectTexturesCount + level.spriteTexturesCount + UI::BAR_MAX, this, fillCallback);
         // add textures
         for (int i = texIdx; i < level.objectTexturesCount; i++) {
             TR::ObjectTexture &t = level.objectTextures[i];
@@ -1037,32 +1252,108 @@ struct Level : IGame {
         for (int i = 0; i < UI::BAR_MAX; i++)
             tiles->add(short4(i * 32, 4096, i * 32 + bar[i].x, 4096 + bar[i].y), texIdx++);
 
-        // get result texture
-        atlas = tiles->pack();
-        atlas->setFilterQuality(Core::settings.detail.filter);
-
-        delete tiles;
+        // get result pixels
+        atlasPixels = tiles->build();
+        atlasWidth  = tiles->width;
+        atlasHeight = tiles->height;
 
-        LOG("atlas: %d x %d\n", atlas->width, atlas->height);
-        PROFILE_LABEL(TEXTURE, atlas->ID, "atlas");
+        if (fileName[0])
+            saveAtlas(fileName, atlasPixels, atlasWidth, atlasHeight);
 
-        uint32 whitePix = 0xFFFFFFFF;
-        cube = new Texture(1, 1, Texture::RGBA, true, &whitePix);
+        delete tiles;
 
         delete[] level.tiles;
         level.tiles = NULL;
-    #else
-        cube = NULL;
+    }
+
+// baked atlas: header, remapped object & sprite textures, generated bar tiles and atlas pixels
+    void saveAtlas(const char *fileName, const uint32 *pixels, int width, int height) {
+        int32 header[] = { int32(FOURCC("OLAT")), BAKED_VERSION, width, height, level.objectTexturesCount, level.spriteTexturesCount };
+
+        int size = sizeof(header)
+                 + level.objectTexturesCount * sizeof(TR::ObjectTexture)
+                 + level.spriteTexturesCount * sizeof(TR::SpriteTexture)
+                 + sizeof(barTiles)
+                 + width * height * sizeof(uint32);
+
+        char *data = new char[size];
+        char *ptr  = data;
+
+        memcpy(ptr, header, sizeof(header));
+        ptr += sizeof(header);
+        memcpy(ptr, level.objectTextures, level.objectTexturesCount * sizeof(TR::ObjectTexture));
+        ptr += level.objectTexturesCount * sizeof(TR::ObjectTexture);
+        memcpy(ptr, level.spriteTextures, level.spriteTexturesCount * sizeof(TR::SpriteTexture));
+        ptr += level.spriteTexturesCount * sizeof(TR::SpriteTexture);
+        memcpy(ptr, barTiles, sizeof(barTiles));
+        ptr += sizeof(barTiles);
+        memcpy(ptr, pixels, width * height * sizeof(uint32));
+
+        Stream::write(fileName, data, size);
+        delete[] data;
+    }
+
+    bool loadAtlas(const char *fileName) {
+        if (!Stream::exists(fileName))
+            return false;
+
+        Stream stream(fileName);
+
+        int32 header[6];
+        if (stream.size < int(sizeof(header)))
+            return false;
+        stream.raw(header, sizeof(header));
+
+        int width  = header[2];
+        int height = header[3];
+
+        if (header[0] != int32(FOURCC("OLAT")) || header[1] != BAKED_VERSION ||
+            header[4] != level.objectTexturesCount || header[5] != level.spriteTexturesCount ||
+            stream.size != int(sizeof(header) + level.objectTexturesCount * sizeof(TR::ObjectTexture) + level.spriteTexturesCount * sizeof(TR::SpriteTexture) + sizeof(barTiles) + width * height * sizeof(uint32))) {
+            LOG("! invalid baked atlas \"%s\"\n", fileName);
+            return false;
+        }
+
+        stream.raw(level.objectTextures, level.objectTexturesCount * sizeof(TR::ObjectTexture));
+        stream.raw(level.spriteTextures, level.spriteTexturesCount * sizeof(TR::SpriteTexture));
+        stream.raw(barTiles, sizeof(barTiles));
+
+        stream.read(atlasPixels, width * height);
+        atlasWidth  = width;
+        atlasHeight = height;
+
+        return true;
+    }
+#endif
+
+    void initTextures() {
+        ASSERT(level.tilesCount);
+
+    #ifndef SPLIT_BY_TILE
 
         #ifdef _PSP
-            atlas = new Texture(level.tiles4, level.tilesCount, level.cluts, level.clutsCount);
-        #else
-            level.initTiles();
+            #error atlas packing is not allowed for this platform
+        #endif
 
-            atlas = new Texture(level.tiles, level.tilesCount);
-            
-            delete[] level.tiles;
-            level.tiles = NULL;
+        char fileName[sizeof(Stream::cacheDir) + 32];
+        if (Stream::cacheDir[0])
+            sprintf(fileName, "%s%08X.xat", Stream::cacheDir, level.hash);
+        else
+            fileName[0] = 0;
+
+        bool baked = fileName[0] && loadAtlas(fileName);
+        if (baked) {
+            delete[] level.tiles8;
+            delete[] level.tiles16;
+            level.tiles8  = NULL;
+            level.tiles16 = NULL;
+        } else
+            buildAtlas(fileName);
+
+        LOG("atlas: %d x %d%s\n", atlasWidth, atlasHeight, baked ? " baked" : "");
+    #else
+        #ifndef _PSP
+            level.initTiles();
         #endif
 
         for (int i = 0; i < level.objectTexturesCount; i++) {
@@ -1104,6 +1395,31 @@ struct Level : IGame {
     #endif
     }
 
+    void uploadTextures() {
+    #ifndef SPLIT_BY_TILE
+        atlas = new Texture(atlasWidth, atlasHeight, Texture::RGBA, Texture::MIPMAPS, atlasPixels);
+        delete[] atlasPixels;
+        atlasPixels = NULL;
+
+        atlas->setFilterQuality(Core::settings.detail.filter);
+        PROFILE_LABEL(TEXTURE, atlas->ID, "atlas");
+
+        uint32 whitePix = 0xFFFFFFFF;
+        cube = new Texture(1, 1, Texture::RGBA, true, &whitePix);
+    #else
+        cube = NULL;
+
+        #ifdef _PSP
+            atlas = new Texture(level.tiles4, level.tilesCount, level.cluts, level.clutsCount);
+        #else
+            atlas = new Texture(level.tiles, level.tilesCount);
+            
+            delete[] level.tiles;
+            level.tiles = NULL;
+        #endif
+    #endif
+    }
+
     void initOverrides() {
     /*
         for (int i = 0; i < level.entitiesCount; i++) {
@@ -1190,17 +1506,28 @@ struct Level : IGame {
         Core::mViewProj = m;
     }
 
-    void prepareRooms(int *roomsList, int roomsCount) {
-        bool hasSky = false;
+    void cullRooms(ViewList &view) {
+        view.hasSky = false;
+        for (int i = 0; i < view.roomsCount; i++)
+            view.hasSky |= level.rooms[view.roomsList[i]].flags.sky;
 
+    #ifndef SPLIT_BY_TILE
+        if (Core::pass != Core::passShadow && viewsOpen == 1) // nested views draw all static meshes
+            for (int i = 0; i < view.roomsCount; i++)
+                clipStatics(view.roomsList[i]);
+    #endif
+    }
+
+    void setRoomsVisible(const ViewList &view) {
         for (int i = 0; i < level.roomsCount; i++)
             level.rooms[i].flags.visible = false;
 
-        for (int i = 0; i < roomsCount; i++) {
-            TR::Room &r = level.rooms[roomsList[i]];
-            hasSky |= r.flags.sky;
-            r.flags.visible = true;
-        }
+        for (int i = 0; i < view.roomsCount; i++)
+            level.rooms[view.roomsList[i]].flags.visible = true;
+    }
+
+    void prepareRooms(const ViewList &view) {
+        setRoomsVisible(view);
 
         if (Core::pass == Core::passShadow)
             return;
@@ -1219,124 +1546,146 @@ struct Level : IGame {
 
         setMainLight(player);
 
-        if (hasSky)
+        if (view.hasSky)
             renderSky();
     }
 
-    void renderRooms(int *roomsList, int roomsCount, int transp) {
-        PROFILE_MARKER("ROOMS");
+    void renderRoom(int roomIndex, int transp) {
+        Basis basis;
+        basis.identity();
+        basis.pos = level.rooms[roomIndex].getOffset();
 
-        if (Core::pass == Core::passShadow)
-            return;
+        setMainLight(player);
+        setRoomParams(roomIndex, Shader::ROOM, 1.0f, intensityf(level.rooms[roomIndex].ambient), 0.0f, 1.0f, transp == 1);
+        Shader *sh = Core::active.shader;
+
+        sh->setParam(uLightColor, Core::lightColor[0], MAX_LIGHTS);
+        sh->setParam(uLightPos,   Core::lightPos[0],   MAX_LIGHTS);
 
+        Core::setBasis(&basis, 1);
+
+        Core::mModel.identity();
+        Core::mModel.setPos(basis.pos);
+
+        mesh->transparent = transp;
+        mesh->renderRoomGeometry(roomIndex, viewsOpen == 1);
+    }
+
+    void renderRoomSprites(int roomIndex) {
         Basis basis;
         basis.identity();
+        basis.pos = level.rooms[roomIndex].getOffset();
+    #ifdef MERGE_SPRITES
+        basis.rot = Core::mViewInv.getRot();
+    #endif
 
-        Core::mModel.identity();
+        setMainLight(player);
+        setRoomParams(roomIndex, Shader::SPRITE, 1.0f, 1.0f, 0.0f, 1.0f, true);
+        Shader *sh = Core::active.shader;
 
-        switch (transp) {
-            case 0 : Core::setBlending(bmNone);  break;
-            case 1 : Core::setBlending(bmAlpha); break;
-            case 2 : Core::setBlending(bmAdd);   Core::setDepthWrite(false); break;
-        }
+        sh->setParam(uLightColor, Core::lightColor[0], MAX_LIGHTS);
+        sh->setParam(uLightPos,   Core::lightPos[0],   MAX_LIGHTS);
+
+        Core::setBasis(&basis, 1);
+
+        mesh->renderRoomSprites(roomIndex);
+    }
+
+    void queueRooms(int *roomsList, int roomsCount, int transp) {
+        if (Core::pass == Core::passShadow)
+            return;
 
         int i     = 0;
         int end   = roomsCount;
         int dir   = 1;
 
-        if (transp) {
+        if (transp) { // back to front
             i   = roomsCount - 1;
             end = -1;
             dir = -1;
         }
 
+        int layer = getDrawLayer(transp);
+
         while (i != end) {
             int roomIndex = roomsList[i];
             MeshBuilder::RoomRange &range = mesh->rooms[roomIndex];
+            i += dir;
 
-            if (!range.geometry[transp].count) {
-                i += dir;
+            if (!range.geometry[transp].count)
                 continue;
-            }
-
-            setRoomParams(roomIndex, Shader::ROOM, 1.0f, intensityf(level.rooms[roomIndex].ambient), 0.0f, 1.0f, transp == 1);
-            Shader *sh = Core::active.shader;
-
-            sh->setParam(uLightColor, Core::lightColor[0], MAX_LIGHTS);
-            sh->setParam(uLightPos,   Core::lightPos[0],   MAX_LIGHTS);
 
-            basis.pos = level.rooms[roomIndex].getOffset();
-            Core::setBasis(&basis, 1);
-
-            Core::mModel.setPos(basis.pos);
-
-            mesh->transparent = transp;
-            mesh->renderRoomGeometry(roomIndex);
-
-            i += dir;
+            TR::Room &room = level.rooms[roomIndex];
+            vec3 center = room.getOffset() + vec3(float(room.xSectors * 512), float(room.info.yBottom + room.info.yTop) * 0.5f, float(room.zSectors * 512));
+        #ifdef SPLIT_BY_TILE
+            int texture = range.geometry[transp].ranges[0].tile;
+        #else
+            int texture = 0;
+        #endif
+            queueDraw(DRAW_ROOM, layer, roomIndex, Shader::ROOM, room.flags.water, texture, (center - Core::viewPos).length());
         }
 
-        Core::setDepthWrite(true);
-
         if (transp == 1) {
-            Core::setBlending(bmAlpha);
-
-            #ifdef MERGE_SPRITES
-                basis.rot = Core::mViewInv.getRot();
-            #else
-                basis.rot = quat(0, 0, 0, 1);
-            #endif
-
             for (int i = 0; i < roomsCount; i++) {
-                level.rooms[roomsList[i]].flags.visible = true;
-
                 int roomIndex = roomsList[i];
-                MeshBuilder::RoomRange &range = mesh->rooms[roomIndex];
-
-                if (!range.sprites.iCount)
+                if (!mesh->rooms[roomIndex].sprites.iCount)
                     continue;
 
-                setRoomParams(roomIndex, Shader::SPRITE, 1.0f, 1.0f, 0.0f, 1.0f, true);
-                Shader *sh = Core::active.shader;
-
-                sh->setParam(uLightColor, Core::lightColor[0], MAX_LIGHTS);
-                sh->setParam(uLightPos,   Core::lightPos[0],   MAX_LIGHTS);
-
-                basis.pos = level.rooms[roomIndex].getOffset();
-                Core::setBasis(&basis, 1);
-
-                mesh->renderRoomSprites(roomIndex);
+                TR::Room &room = level.rooms[roomIndex];
+                vec3 center = room.getOffset() + vec3(float(room.xSectors * 512), float(room.info.yBottom + room.info.yTop) * 0.5f, float(room.zSectors * 512));
+                queueDraw(DRAW_ROOM_SPRITES, layer, roomIndex, Shader::SPRITE, room.flags.water, 0, (center - Core::viewPos).length());
             }
         }
-
-        Core::setBlending(bmNone);
     }
 
-    void renderEntity(const TR::Entity &entity) {
+    bool isEntityVisible(const TR::Entity &entity) {
         //if (entity.room != lara->getRoomIndex()) return;
-        if (Core::pass == Core::passShadow && !entity.castShadow()) return;
+        if (Core::pass == Core::passShadow && !entity.castShadow()) return false;
         bool isModel = entity.modelIndex > 0;
 
         if (isModel) {
-            if (!mesh->models[entity.modelIndex - 1].geometry[mesh->transparent].count) return;
+            if (!mesh->models[entity.modelIndex - 1].geometry[mesh->transparent].count) return false;
         } else {
-            if (mesh->sequences[-(entity.modelIndex + 1)].transp != mesh->transparent) return;
+            if (mesh->sequences[-(entity.modelIndex + 1)].transp != mesh->transparent) return false;
         }
 
         Controller *controller = (Controller*)entity.controller;
-
-        int roomIndex = controller->getRoomIndex();
-        TR::Room &room = level.rooms[roomIndex];
+        TR::Room &room = level.rooms[controller->getRoomIndex()];
 
         if (!entity.isLara() && !entity.isActor())
             if (!room.flags.visible || controller->flags.invisible)// || controller->flags.rendered)
-                return;
+                return false;
 
-        float intensity = controller->intensity < 0.0f ? intensityf(room.ambient) : controller->intensity;
+        return true;
+    }
 
-        Shader::Type type = isModel ? Shader::ENTITY : Shader::SPRITE;
+    Shader::Type getEntityShader(const TR::Entity &entity) {
         if (entity.type == TR::Entity::CRYSTAL)
-            type = Shader::MIRROR;
+            return Shader::MIRROR;
+        return entity.modelIndex > 0 ? Shader::ENTITY : Shader::SPRITE;
+    }
+
+    float getEntityIntensity(Controller *controller) {
+        return controller->intensity < 0.0f ? intensityf(level.rooms[controller->getRoomIndex()].ambient) : controller->intensity;
+    }
+
+// store last calculated ambient into controller (once per frame)
+    void updateEntityAmbient(Controller *controller) {
+        if (!ambientCache || Core::stats.frame == controller->ambientFrame)
+            return;
+        controller->ambientFrame = Core::stats.frame;
+
+        AmbientCache::Cube cube;
+        ambientCache->getAmbient(controller->getRoomIndex(), controller->getPos(), cube);
+        if (cube.status == AmbientCache::Cube::READY)
+            memcpy(controller->ambient, cube.colors, sizeof(cube.colors));
+    }
+
+    void setEntityParams(const TR::Entity &entity, Shader::Type type) {
+        Controller *controller = (Controller*)entity.controller;
+
+        int roomIndex = controller->getRoomIndex();
+        float intensity = getEntityIntensity(controller);
 
         if (type == Shader::SPRITE) {
             float alpha = (entity.type == TR::Entity::SMOKE || entity.type == TR::Entity::WATER_SPLASH || entity.type == TR::Entity::SPARKLES) ? 0.75f : 1.0f;
@@ -1345,17 +1694,9 @@ struct Level : IGame {
         } else
             setRoomParams(roomIndex, type, 1.0f, intensity, controller->specular, 1.0f, mesh->transparent == 1);
 
-        if (isModel) { // model
-            vec3 pos = controller->getPos();
-            if (ambientCache) {
-                AmbientCache::Cube cube;
-                if (Core::stats.frame != controller->jointsFrame) {
-                    ambientCache->getAmbient(roomIndex, pos, cube);
-                    if (cube.status == AmbientCache::Cube::READY)
-                        memcpy(controller->ambient, cube.colors, sizeof(cube.colors)); // store last calculated ambient into controller
-                }
+        if (entity.modelIndex > 0) { // model
+            if (ambientCache)
                 Core::active.shader->setParam(uAmbient, controller->ambient[0], 6);
-            }
 
             setMainLight(controller);
         } else { // sprite
@@ -1365,8 +1706,85 @@ struct Level : IGame {
         
         Core::active.shader->setParam(uLightPos,   Core::lightPos[0],   MAX_LIGHTS);
         Core::active.shader->setParam(uLightColor, Core::lightColor[0], MAX_LIGHTS);
+    }
+
+    void renderEntity(const TR::Entity &entity) {
+        if (!isEntityVisible(entity))
+            return;
+
+        Controller *controller = (Controller*)entity.controller;
+        Shader::Type type = getEntityShader(entity);
 
-        controller->render(camera->frustum, mesh, type, room.flags.water);
+        if (entity.modelIndex > 0)
+            updateEntityAmbient(controller);
+
+        setEntityParams(entity, type);
+
+        controller->render(camera->frustum, mesh, type, level.rooms[controller->getRoomIndex()].flags.water);
+    }
+
+// entities of the same model with equal shader params are drawn by a single DIP, returns the last consumed draw list item
+    int renderEntityInstances(int first, int last) {
+        const DrawItem &head = drawList[first];
+        const TR::Entity &entity = level.entities[head.index];
+        Controller *controller = (Controller*)entity.controller;
+
+        int modelIndex = entity.modelIndex - 1;
+        int maxCount   = (instancing && modelIndex >= 0 && getEntityShader(entity) == Shader::ENTITY) ? mesh->getInstancesCount(modelIndex) : 0;
+
+        if (!maxCount || !controller->canInstance()) {
+            renderEntity(entity);
+            return first;
+        }
+
+        int mCount = level.models[modelIndex].mCount;
+        Controller *base = NULL;
+        int count = 0;
+        int end   = first;
+
+        for (int i = first; i < last && count < maxCount; i++) {
+            const DrawItem &item = drawList[i];
+            const TR::Entity &e = level.entities[item.index];
+            Controller *c = (Controller*)e.controller;
+
+            if (item.type != DRAW_ENTITY || item.layer != head.layer || e.modelIndex != entity.modelIndex || !c->canInstance())
+                break;
+
+            if (isEntityVisible(e)) {
+                updateEntityAmbient(c);
+
+                if (base && Core::pass != Core::passShadow && !isSameEntityParams(base, c))
+                    break;
+
+                if (c->prepareInstance(camera->frustum)) {
+                    if (!base)
+                        base = c;
+                    memcpy(instanceBasis + count * mCount, c->joints, mCount * sizeof(Basis));
+                    count++;
+                }
+            }
+
+            end = i;
+        }
+
+        if (!count)
+            return end;
+
+        setEntityParams(base->getEntity(), Shader::ENTITY);
+        Core::setBasis(instanceBasis, count * mCount);
+        mesh->renderModelInstances(modelIndex, count);
+        Core::stats.instances += count;
+
+        return end;
+    }
+
+    bool isSameEntityParams(Controller *a, Controller *b) {
+        return a->getRoomIndex()   == b->getRoomIndex()   &&
+               a->specular         == b->specular         &&
+               a->mainLightPos     == b->mainLightPos     &&
+               a->mainLightColor   == b->mainLightColor   &&
+               getEntityIntensity(a) == getEntityIntensity(b) &&
+               (!ambientCache || !memcmp(a->ambient, b->ambient, sizeof(a->ambient)));
     }
 
     void update() {
@@ -1422,18 +1840,18 @@ struct Level : IGame {
 
             updateEffect();
 
-            Controller *c = Controller::first;
-            while (c) {
-                Controller *next = c->next;
-                c->update();
-                c = next;
-            }
+            updateControllers();
 
             if (waterCache) 
                 waterCache->update();
 
+            if (trackCache)
+                trackCache->update(player->getRoomIndex());
+
             Controller::clearInactive();
 
+            updateRoomEntities();
+
             if (camera->isUnderwater()) {
                 if (!sndUnderwater) {
                     sndUnderwater = playSound(TR::SND_UNDERWATER, vec3(0.0f), Sound::LOOP | Sound::MUSIC);
@@ -1452,6 +1870,90 @@ struct Level : IGame {
         }
     }
 
+// the tick runs in three phases:
+// read  - world queries of the controllers (Controller::prepare) by jobs, nothing is changed yet
+// apply - gameplay logic (AI decisions, collisions, triggers, spawning, sounds) is serial in the list order
+// pose  - models drawn by the last frame are posed by jobs, others are posed on demand by gameplay or rendering
+// without parallelUpdate there is no read phase, controllers query the world in the apply phase (serial reference)
+    void updateControllers() {
+        int count = 0;
+        tickIndex++;
+
+        Controller *c;
+        if (parallelUpdate) {
+            for (c = Controller::first; c && count < level.entitiesCount; c = c->next)
+                poseList[count++] = c;
+
+            if (count >= UPDATE_JOB_MIN)
+                parallelFor(count, Controller::prepareJob, poseList);
+            else
+                Controller::prepareJob(poseList, 0, count);
+        }
+
+        c = Controller::first;
+        while (c) {
+            Controller *next = c->next;
+            c->update();
+            c = next;
+        }
+
+    #ifdef _DEBUG
+        if (parallelUpdate)
+            checkPrepare();
+    #endif
+
+        count = 0;
+        for (c = Controller::first; c && count < level.entitiesCount; c = c->next)
+            if (c->joints && c->getModel() && c->drawIndex == frameIndex)
+                poseList[count++] = c;
+
+        if (parallelUpdate && count >= UPDATE_JOB_MIN)
+            parallelFor(count, Controller::updateJointsJob, poseList);
+        else
+            Controller::updateJoints(poseList, count);
+
+        for (int i = 0; i < count; i++)
+            poseList[i]->storeJoints(tickIndex);
+
+        for (int i = 0; i < 2; i++)
+            if (players[i])
+                players[i]->camera->storeView(tickIndex);
+    }
+
+// gameplay runs at the fixed tick rate, menus and cutscenes (synced with the soundtrack) step by the frame time
+    bool isFixedTick() {
+        return !inventory.isActive() && !level.isTitle() && !level.isCutsceneLevel();
+    }
+
+// poses and views for rendering between the two last ticks
+    void interpolate() {
+        if (tickAlpha >= 1.0f)
+            return;
+
+        for (Controller *c = Controller::first; c; c = c->next)
+            if (c->joints)
+                c->interpolateJoints(tickIndex, tickAlpha);
+
+        for (int i = 0; i < 2; i++)
+            if (players[i])
+                players[i]->camera->interpolateView(tickIndex, tickAlpha);
+    }
+
+#ifdef _DEBUG
+// the read phase sees the world as of the tick start, report the first controller that the apply phase made it stale for
+    void checkPrepare() {
+        static bool reported = false;
+        if (reported) return;
+
+        for (Controller *c = Controller::first; c; c = c->next)
+            if (!c->checkPrepare()) {
+                LOG("! read phase is stale: entity %d\n", c->entity);
+                reported = true;
+                return;
+            }
+    }
+#endif
+
     void updateEffect() {
         if (effect == TR::Effect::NONE)
             return;
@@ -1492,98 +1994,208 @@ struct Level : IGame {
         setupBinding();
     }
 
-    void renderEntitiesTransp(int transp) {
-        mesh->transparent = transp;
-        for (int i = 0; i < level.entitiesCount; i++) {
-            TR::Entity &e = level.entities[i];
-            if (!e.controller || e.modelIndex == 0) continue;
-            renderEntity(e);
+    void queueEntity(int index, int layer, int transp) {
+        TR::Entity &e = level.entities[index];
+        if (!e.controller || e.modelIndex == 0 || entityClipped[index]) return;
+        if (Core::pass == Core::passShadow && !e.castShadow()) return;
+
+        bool isModel = e.modelIndex > 0;
+        if (isModel) {
+            if (!mesh->models[e.modelIndex - 1].geometry[transp].count) return;
+        } else {
+            if (mesh->sequences[-(e.modelIndex + 1)].transp != transp) return;
         }
+
+        Controller *controller = (Controller*)e.controller;
+
+        Shader::Type type = isModel ? Shader::ENTITY : Shader::SPRITE;
+        if (e.type == TR::Entity::CRYSTAL)
+            type = Shader::MIRROR;
+
+        queueDraw(DRAW_ENTITY, layer, index, type, level.rooms[controller->getRoomIndex()].flags.water, isModel ? e.modelIndex : 0, (controller->pos - Core::viewPos).length());
+    }
+
+    void queueShadow(int index) {
+        TR::Entity &e = level.entities[index];
+        Controller *controller = (Controller*)e.controller;
+        if (controller && e.castShadow() && !entityClipped[index])
+            queueDraw(DRAW_SHADOW, LAYER_SHADOW, index, Shader::FLASH, 0, 0, (controller->pos - Core::viewPos).length());
     }
 
-    void renderEntities(int transp) {
+// only entities of the visible rooms and the always rendered bucket are visited
+    void queueEntities(int *roomsList, int roomsCount, int transp) {
         if (Core::pass == Core::passAmbient) // TODO allow static entities
             return;
 
-        PROFILE_MARKER("ENTITIES");
+        int layer = getDrawLayer(transp);
+        bool shadows = transp == 1 && Core::pass == Core::passCompose; // shadow blobs of the rendered entities
 
-        if (transp == 0) {
-            Core::setBlending(bmNone);
-            renderEntitiesTransp(transp);
+        for (int j = 0; j <= roomsCount; j++) {
+            int bucket = j < roomsCount ? roomsList[j] : level.roomsCount;
+            for (int i = roomEntities[bucket]; i > -1; i = entityNext[i]) {
+                queueEntity(i, layer, transp);
+                if (shadows)
+                    queueShadow(i);
+                Core::stats.entities++;
+            }
         }
+    }
 
-        if (transp == 1) {
-            Core::setBlending(bmAlpha);
-            renderEntitiesTransp(transp);
+    static int getDrawLayer(int transp) {
+        const int layers[] = { LAYER_OPAQUE, LAYER_ALPHA, LAYER_ADD };
+        return layers[transp];
+    }
 
-            Core::setBlending(bmMult);
-            for (int i = 0; i < level.entitiesCount; i++) {
-                TR::Entity &entity = level.entities[i];
-                Controller *controller = (Controller*)entity.controller;
-                if (controller && controller->flags.rendered && controller->getEntity().castShadow())
-                    controller->renderShadow(mesh);
+// sort key (msb -> lsb): layer | state (shader, fx, texture or model) | depth (front to back) | sequence
+// alpha blended layer is sorted back to front first
+    void queueDraw(DrawType type, int layer, int index, int shader, int fx, int texture, float dist) {
+        ASSERT(drawCount < drawCapacity);
+        DrawItem &item = drawList[drawCount];
+        item.type  = type;
+        item.layer = layer;
+        item.index = index;
+
+        uint64 seq   = uint64(drawCount++);
+        uint64 state = (uint64(shader & 7) << 18) | (uint64(fx & 3) << 16) | uint64(texture & 0xFFFF);
+        uint64 depth = uint64(clamp(int(dist), 0, 0xFFFFFF));
+
+        if (!sortDraws)
+            item.key = seq;
+        else if (layer == LAYER_ALPHA)
+            item.key = (uint64(layer) << 62) | ((0xFFFFFF - depth) << 38) | (state << 17) | seq;
+        else
+            item.key = (uint64(layer) << 62) | (state << 41) | (depth << 17) | seq;
+    }
+
+    void renderDrawList(int first, int last) {
+        PROFILE_MARKER("DRAW_LIST");
+
+        for (int i = first; i < last; i++) {
+            const DrawItem &item = drawList[i];
+
+        // controllers may change render state, so restore it for every item
+            switch (item.layer) {
+                case LAYER_OPAQUE : Core::setBlending(bmNone);  Core::setDepthWrite(true);  break;
+                case LAYER_ALPHA  : Core::setBlending(bmAlpha); Core::setDepthWrite(true);  break;
+                case LAYER_SHADOW : Core::setBlending(bmMult);  Core::setDepthWrite(true);  break;
+                case LAYER_ADD    : Core::setBlending(bmAdd);   Core::setDepthWrite(false); break;
             }
-            Core::setBlending(bmNone);
-        }
 
-        if (transp == 2) {
-            Core::setDepthWrite(false);
-            Core::setBlending(bmAdd);
-            renderEntitiesTransp(transp);
-            Core::setDepthWrite(true);
+            int transp = item.layer == LAYER_ADD ? 2 : (item.layer == LAYER_ALPHA ? 1 : 0);
+
+            switch (item.type) {
+                case DRAW_ROOM         : renderRoom(item.index, transp); break;
+                case DRAW_ROOM_SPRITES : renderRoomSprites(item.index); break;
+                case DRAW_ENTITY       :
+                    mesh->transparent = transp;
+                #ifdef MERGE_MODELS
+                    i = renderEntityInstances(i, last);
+                #else
+                    renderEntity(level.entities[item.index]);
+                #endif
+                    break;
+                case DRAW_SHADOW       : {
+                    Controller *controller = (Controller*)level.entities[item.index].controller;
+                    if (controller->flags.rendered)
+                        controller->renderShadow(mesh);
+                    break;
+                }
+            }
         }
-    }
 
-    bool checkPortal(const TR::Room &room, const TR::Room::Portal &portal, const vec4 &viewPort, vec4 &clipPort) {
-        vec3 n = portal.normal;
-        vec3 v = Core::viewPos - (room.getOffset() + portal.vertices[0]);
+        Core::setDepthWrite(true);
+        Core::setBlending(bmNone);
+    }
 
-        if (n.dot(v) <= 0.0f)
+    bool checkPortal(const TR::PortalInfo &portal, const vec4 &viewPort, vec4 &clipPort) {
+        if (portal.normal.dot(Core::viewPos) - portal.dist <= -viewRadius)
             return false;
 
-        int  zClip = 0;
-        vec4 p[4];
+        const mat4 &m = Core::mViewProj;
+        float px[4], py[4], pw[4];
+        int   visible = 0; // w > 0 vertex mask
 
-        clipPort = vec4(INF, INF, -INF, -INF);
+    #ifdef __SSE2__
+        __m128 x = _mm_loadu_ps(portal.x);
+        __m128 y = _mm_loadu_ps(portal.y);
+        __m128 z = _mm_loadu_ps(portal.z);
 
-        for (int i = 0; i < 4; i++) {
-            p[i] = Core::mViewProj * vec4(vec3(portal.vertices[i]) + room.getOffset(), 1.0f);
+        #define PROJECT(a, b, c, d) _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(a)), _mm_mul_ps(y, _mm_set1_ps(b))), _mm_mul_ps(z, _mm_set1_ps(c))), _mm_set1_ps(d))
+        __m128 cx = PROJECT(m.e00, m.e01, m.e02, m.e03);
+        __m128 cy = PROJECT(m.e10, m.e11, m.e12, m.e13);
+        __m128 cw = PROJECT(m.e30, m.e31, m.e32, m.e33);
+        #undef PROJECT
+
+        __m128 mask = _mm_cmpgt_ps(cw, _mm_setzero_ps());
+        visible = _mm_movemask_ps(mask);
+        if (!visible)
+            return false;
 
-            if (p[i].w > 0.0f) {
-                p[i].xyz() *= (1.0f / p[i].w);
+        __m128 rw   = _mm_div_ps(_mm_set1_ps(1.0f), cw);
+        __m128 sx   = _mm_mul_ps(cx, rw);
+        __m128 sy   = _mm_mul_ps(cy, rw);
+        __m128 pInf = _mm_set1_ps( INF);
+        __m128 nInf = _mm_set1_ps(-INF);
+        // min(x), min(y), max(x), max(y) of the projected w > 0 vertices
+        __m128 minX = _mm_or_ps(_mm_and_ps(mask, sx), _mm_andnot_ps(mask, pInf));
+        __m128 minY = _mm_or_ps(_mm_and_ps(mask, sy), _mm_andnot_ps(mask, pInf));
+        __m128 maxX = _mm_or_ps(_mm_and_ps(mask, sx), _mm_andnot_ps(mask, nInf));
+        __m128 maxY = _mm_or_ps(_mm_and_ps(mask, sy), _mm_andnot_ps(mask, nInf));
+        __m128 lo = _mm_min_ps(_mm_unpacklo_ps(minX, minY), _mm_unpackhi_ps(minX, minY)); // x01 y01 x23 y23
+        __m128 hi = _mm_max_ps(_mm_unpacklo_ps(maxX, maxY), _mm_unpackhi_ps(maxX, maxY));
+        lo = _mm_min_ps(lo, _mm_movehl_ps(lo, lo));
+        hi = _mm_max_ps(hi, _mm_movehl_ps(hi, hi));
+        _mm_storel_pi((__m64*)&clipPort.x, lo);
+        _mm_storel_pi((__m64*)&clipPort.z, hi);
+
+        _mm_storeu_ps(px, cx);
+        _mm_storeu_ps(py, cy);
+        _mm_storeu_ps(pw, cw);
+    #else
+        clipPort = vec4(INF, INF, -INF, -INF);
 
-                clipPort.x = min(clipPort.x, p[i].x);
-                clipPort.y = min(clipPort.y, p[i].y);
-                clipPort.z = max(clipPort.z, p[i].x);
-                clipPort.w = max(clipPort.w, p[i].y);
-            } else
-                zClip++;
+        for (int i = 0; i < 4; i++) {
+            px[i] = m.e00 * portal.x[i] + m.e01 * portal.y[i] + m.e02 * portal.z[i] + m.e03;
+            py[i] = m.e10 * portal.x[i] + m.e11 * portal.y[i] + m.e12 * portal.z[i] + m.e13;
+            pw[i] = m.e30 * portal.x[i] + m.e31 * portal.y[i] + m.e32 * portal.z[i] + m.e33;
+
+            if (pw[i] > 0.0f) {
+                float rw = 1.0f / pw[i];
+                float sx = px[i] * rw;
+                float sy = py[i] * rw;
+
+                clipPort.x = min(clipPort.x, sx);
+                clipPort.y = min(clipPort.y, sy);
+                clipPort.z = max(clipPort.z, sx);
+                clipPort.w = max(clipPort.w, sy);
+                visible |= 1 << i;
+            }
         }
 
-        if (zClip == 4)
+        if (!visible)
             return false;
+    #endif
 
-        if (zClip > 0) {
+        if (visible != 15) { // edges crossing the near plane, the sign of x & y doesn't depend on the (positive) w
             for (int i = 0; i < 4; i++) {
-                vec4 &a = p[i];
-                vec4 &b = p[(i + 1) % 4];
+                int j = (i + 1) % 4;
 
-                if ((a.w > 0.0f) ^ (b.w > 0.0f)) {
+                if ((pw[i] > 0.0f) ^ (pw[j] > 0.0f)) {
 
-                    if (a.x < 0.0f && b.x < 0.0f)
+                    if (px[i] < 0.0f && px[j] < 0.0f)
                         clipPort.x = -1.0f;
                     else
-                        if (a.x > 0.0f && b.x > 0.0f)
+                        if (px[i] > 0.0f && px[j] > 0.0f)
                             clipPort.z = 1.0f;
                         else {
                             clipPort.x = -1.0f;
                             clipPort.z =  1.0f;
                         }
 
-                    if (a.y < 0.0f && b.y < 0.0f)
+                    if (py[i] < 0.0f && py[j] < 0.0f)
                         clipPort.y = -1.0f;
                     else
-                        if (a.y > 0.0f && b.y > 0.0f)
+                        if (py[i] > 0.0f && py[j] > 0.0f)
                             clipPort.w = 1.0f;
                         else {
                             clipPort.y = -1.0f;
@@ -1605,36 +2217,160 @@ struct Level : IGame {
         return true;
     }
 
-    void getVisibleRooms(int *roomsList, int &roomsCount, int from, int to, const vec4 &viewPort, bool water, int count = 0) {
-        if (count > 16) {
-            //ASSERT(false);
-            return;
+    bool isRoomBeyond(const TR::Room &room, const vec4 &plane) {
+        const TR::Room::Info &info = room.info;
+        vec3 p(float(plane.x > 0.0f ? (info.x + room.xSectors * 1024) : info.x),
+               float(plane.y > 0.0f ? info.yBottom : info.yTop),
+               float(plane.z > 0.0f ? (info.z + room.zSectors * 1024) : info.z));
+        return plane.xyz().dot(p) + plane.w < 0.0f;
+    }
+
+// depth-first traversal with an explicit stack, rooms are listed in the same order as the recursive walk
+// portals to rooms outside of the start room PVS or behind the far plane are rejected before projection
+    void getVisibleRooms(int *roomsList, int &roomsCount, int roomIndex, const vec4 &viewPort, bool water) {
+        PortalNode *stack = portalStack;
+        int top   = 0;
+        int first = roomsCount;
+
+        int flip = level.state.flags.flipped ? 1 : 0;
+        int start = level.getRoomIndex(roomIndex, flip);
+
+        const mat4 &m = Core::mViewProj;
+        vec4 farPlane(m.e30 - m.e20, m.e31 - m.e21, m.e32 - m.e22, m.e33 - m.e23);
+
+        stack[top].from     = TR::NO_ROOM;
+        stack[top].to       = roomIndex;
+        stack[top].depth    = 0;
+        stack[top].viewPort = viewPort;
+        top++;
+
+        while (top) {
+            PortalNode node = stack[--top];
+
+            int from = node.from;
+            int to   = level.getRoomIndex(node.to, flip);
+
+            TR::Room &room = level.rooms[to];
+            vec4 &port = roomPorts[to];
+
+            if (!room.flags.visible) {
+                if (Core::pass == Core::passCompose && water && waterCache && from != TR::NO_ROOM && (level.rooms[from].flags.water ^ level.rooms[to].flags.water))
+                    waterCache->setVisible(from, to);
+
+                room.flags.visible = true;
+                roomsList[roomsCount++] = to;
+                port = node.viewPort;
+            } else
+                port = vec4(min(port.x, node.viewPort.x), min(port.y, node.viewPort.y), max(port.z, node.viewPort.z), max(port.w, node.viewPort.w));
+
+            if (node.depth >= MAX_PORTAL_DEPTH)
+                continue;
+
+        // push in reverse order to pop the first portal first
+            const TR::PortalInfo *portals = level.portalInfos + level.roomPortals[to];
+            for (int i = room.portalsCount - 1; i >= 0; i--) {
+                const TR::PortalInfo &p = portals[i];
+                PortalNode &next = stack[top];
+
+                if (from == p.roomIndex)
+                    continue;
+
+                int target = level.getRoomIndex(p.roomIndex, flip);
+                if (!level.isPotentiallyVisible(flip, start, target) || isRoomBeyond(level.rooms[target], farPlane))
+                    continue;
+
+                if (checkPortal(p, node.viewPort, next.viewPort)) {
+                    next.from  = to;
+                    next.to    = p.roomIndex;
+                    next.depth = node.depth + 1;
+                    top++;
+                }
+            }
         }
 
-        if (level.rooms[to].alternateRoom > -1 && level.state.flags.flipped)
-            to = level.rooms[to].alternateRoom;
+    // objects may cross the room bounds, so the windows of the adjacent visible rooms are included
+        for (int i = first; i < roomsCount; i++) {
+            int index = roomsList[i];
+            vec4 clip = roomPorts[index];
 
-        TR::Room &room = level.rooms[to];
+            const TR::PortalInfo *portals = level.portalInfos + level.roomPortals[index];
+            for (int j = 0; j < level.rooms[index].portalsCount; j++) {
+                int target = level.getRoomIndex(portals[j].roomIndex, flip);
+                if (!level.rooms[target].flags.visible)
+                    continue;
+                const vec4 &p = roomPorts[target];
+                clip = vec4(min(clip.x, p.x), min(clip.y, p.y), max(clip.z, p.z), max(clip.w, p.w));
+            }
 
-        if (!room.flags.visible) {
-            if (Core::pass == Core::passCompose && water && waterCache && from != TR::NO_ROOM && (level.rooms[from].flags.water ^ level.rooms[to].flags.water))
-                waterCache->setVisible(from, to);
+            roomClip[index] = clip;
+        }
+    }
+
+    static bool isFullClip(const vec4 &clip) {
+        return clip.x <= -1.0f && clip.y <= -1.0f && clip.z >= 1.0f && clip.w >= 1.0f;
+    }
 
-            room.flags.visible = true;
-            roomsList[roomsCount++] = to;
+// check screen-space bounds of the world-space box against the portal window, boxes crossing the camera plane are visible
+    bool isBoxInClip(const Box &box, const vec4 &clip) {
+        const mat4 &m = Core::mViewProj;
+        vec4 rect(INF, INF, -INF, -INF);
+
+        for (int i = 0; i < 8; i++) {
+            vec4 p = m * vec4(box[i], 1.0f);
+            if (p.w < EPS)
+                return true;
+            float iw = 1.0f / p.w;
+            p.x *= iw;
+            p.y *= iw;
+            rect.x = min(rect.x, p.x);
+            rect.y = min(rect.y, p.y);
+            rect.z = max(rect.z, p.x);
+            rect.w = max(rect.w, p.y);
         }
 
-        vec4 clipPort;
-        for (int i = 0; i < room.portalsCount; i++) {
-            TR::Room::Portal &p = room.portals[i];
+        return rect.x <= clip.z && rect.z >= clip.x && rect.y <= clip.w && rect.w >= clip.y;
+    }
+
+    bool isEntityClipped(const TR::Entity &entity, int roomIndex) {
+        if (Core::pass == Core::passShadow || entity.modelIndex <= 0 || isFullClip(roomClip[roomIndex]))
+            return false;
+
+        Controller *controller = (Controller*)entity.controller;
+        if (controller->explodeMask)
+            return false;
 
-            if (from != room.portals[i].roomIndex && checkPortal(room, p, viewPort, clipPort))
-                getVisibleRooms(roomsList, roomsCount, to, p.roomIndex, clipPort, water, count + 1);
+        return !isBoxInClip(controller->getBoundingBox(), roomClip[roomIndex]);
+    }
+
+#ifndef SPLIT_BY_TILE
+// cull static meshes of the room by the view frustum and the room portal window
+    void clipStatics(int roomIndex) {
+        MeshBuilder::RoomRange &range = mesh->rooms[roomIndex];
+        int count = level.rooms[roomIndex].meshesCount;
+        Box  *box     = mesh->staticsBox     + range.statics;
+        bool *visible = mesh->staticsVisible + range.statics;
+
+        viewFrustum.isVisible(box, visible, count);
+
+        const vec4 &clip = roomClip[roomIndex];
+        bool full = isFullClip(clip);
+
+        range.staticsCulled = 0;
+        for (int i = 0; i < count; i++) {
+            if (visible[i] && !full)
+                visible[i] = isBoxInClip(box[i], clip);
+            range.staticsCulled += !visible[i];
         }
+
+        Core::stats.clipped += range.staticsCulled;
     }
+#endif
+
+// visibility, culling and draw list of the view (CPU only)
+    void cullView(ViewList &view, int roomIndex, bool water) {
+        PROFILE_MARKER("CULL");
+        viewsOpen++;
 
-    virtual void renderView(int roomIndex, bool water, bool showUI) {
-        PROFILE_MARKER("VIEW");
         if (water && waterCache) {
             waterCache->reset();
         }
@@ -1642,10 +2378,12 @@ struct Level : IGame {
         for (int i = 0; i < level.roomsCount; i++)
             level.rooms[i].flags.visible = false;
 
-        int roomsList[256];
-        int roomsCount = 0;
+        view.roomsCount = 0;
+        getVisibleRooms(view.roomsList, view.roomsCount, roomIndex, vec4(-1.0f, -1.0f, 1.0f, 1.0f), water);
+        Core::stats.rooms += view.roomsCount;
 
-        getVisibleRooms(roomsList, roomsCount, TR::NO_ROOM, roomIndex, vec4(-1.0f, -1.0f, 1.0f, 1.0f), water);
+        viewFrustum.pos = Core::viewPos;
+        viewFrustum.calcPlanes(Core::mViewProj);
         /*
         if (level.isCutsceneLevel()) {
             for (int i = 0; i < level.roomsCount; i++)
@@ -1654,8 +2392,54 @@ struct Level : IGame {
         }
         */
         if (water && waterCache) {
-            for (int i = 0; i < roomsCount; i++)
-                waterCache->setVisible(roomsList[i]);
+            for (int i = 0; i < view.roomsCount; i++)
+                waterCache->setVisible(view.roomsList[i]);
+        }
+
+        // reject entities out of the room portal window
+        if (Core::pass != Core::passAmbient)
+            for (int j = 0; j < view.roomsCount; j++) {
+                int roomIndex = view.roomsList[j];
+                for (int i = roomEntities[roomIndex]; i > -1; i = entityNext[i]) {
+                    entityClipped[i] = isEntityClipped(level.entities[i], roomIndex);
+                    Core::stats.clipped += entityClipped[i];
+                }
+            }
+
+        cullRooms(view);
+
+        view.drawFirst = drawCount;
+        for (int transp = 0; transp < 3; transp++) {
+            queueRooms(view.roomsList, view.roomsCount, transp);
+            queueEntities(view.roomsList, view.roomsCount, transp);
+        }
+        view.drawLast = drawCount;
+
+        sort(drawList + view.drawFirst, view.drawLast - view.drawFirst);
+
+        updatePoses(view);
+    }
+
+// evaluate joints of all queued models before drawing (a serial getPose loop), not on the first use while drawing
+    void updatePoses(const ViewList &view) {
+        int count = 0;
+        for (int i = view.drawFirst; i < view.drawLast; i++) {
+            const DrawItem &item = drawList[i];
+            if (item.type != DRAW_ENTITY || level.entities[item.index].modelIndex <= 0) continue;
+
+            Controller *controller = (Controller*)level.entities[item.index].controller;
+            controller->drawIndex = frameIndex;
+            if (controller->jointsFrame == Core::stats.frame) continue; // posed already or queued in the other layer
+
+            controller->jointsFrame = Core::stats.frame;
+            poseList[count++] = controller;
+        }
+        Controller::updateJoints(poseList, count);
+    }
+
+// render the culled view for the current camera, may be called for every view that shares the visibility
+    void renderViewList(const ViewList &view, bool water, bool showUI) {
+        if (water && waterCache) {
             waterCache->renderReflect();
 
             Core::Pass pass = Core::pass;
@@ -1663,24 +2447,18 @@ struct Level : IGame {
             Core::pass = pass;
         }
 
-        // clear visibility flag for rooms
-        if (Core::pass != Core::passAmbient)
-            for (int i = 0; i < level.entitiesCount; i++) {
-                Controller *controller = (Controller*)level.entities[i].controller;
-                if (controller)
-                    controller->flags.rendered = false;
-            }
+        // clear rendered flag of the queued entities (reflection view may also set it)
+        for (int i = view.drawFirst; i < view.drawLast; i++)
+            if (drawList[i].type == DRAW_ENTITY || drawList[i].type == DRAW_SHADOW)
+                ((Controller*)level.entities[drawList[i].index].controller)->flags.rendered = false;
 
         if (water) {
             Core::setTarget(NULL, Core::settings.detail.stereo == Core::Settings::STEREO_OFF && players[1] == NULL); // render to back buffer
             setupBinding();
         }
 
-        prepareRooms(roomsList, roomsCount);
-        for (int transp = 0; transp < 3; transp++) {
-            renderRooms(roomsList, roomsCount, transp);
-            renderEntities(transp);
-        }
+        prepareRooms(view);
+        renderDrawList(view.drawFirst, view.drawLast);
 
         Core::setBlending(bmNone);
         if (water && waterCache && waterCache->visible) {
@@ -1699,6 +2477,136 @@ struct Level : IGame {
         }
     }
 
+    void releaseView(const ViewList &view) {
+        drawCount = view.drawFirst;
+        viewsOpen--;
+    }
+
+    virtual void renderView(int roomIndex, bool water, bool showUI) {
+        PROFILE_MARKER("VIEW");
+        ViewList view;
+        cullView(view, roomIndex, water);
+        renderViewList(view, water, showUI);
+        releaseView(view);
+    }
+
+// single view that contains all the given views: camera is moved back from the eyes center
+// so that its frustum encloses the eye frustums, portals are checked with the eyes distance tolerance
+    bool setupSharedView(const mat4 *views, const mat4 *projs, int count) {
+        vec3 corners[8 * 2];
+        vec3 eyes[2];
+        vec3 center(0.0f);
+
+        ASSERT(count <= 2);
+        for (int i = 0; i < count; i++) {
+            mat4 m = (projs[i] * views[i]).inverse();
+            for (int j = 0; j < 8; j++) {
+                vec4 p = m * vec4((j & 1) ? 1.0f : -1.0f, (j & 2) ? 1.0f : -1.0f, (j & 4) ? 1.0f : -1.0f, 1.0f);
+                corners[i * 8 + j] = p.xyz() * (1.0f / p.w);
+            }
+            eyes[i] = views[i].inverse().getPos();
+            center += eyes[i];
+        }
+        center *= 1.0f / count;
+
+        float radius = 0.0f;
+        for (int i = 0; i < count; i++)
+            radius = max(radius, (eyes[i] - center).length());
+
+        mat4 basis = views[0].inverse();
+        vec3 r = basis.right().xyz();
+        vec3 u = basis.up().xyz();
+        vec3 d = basis.dir().xyz(); // backward
+        vec3 apex = center + d * (radius * projs[0].e00);
+
+        vec2 tMin(INF), tMax(-INF);
+        float zMin = INF, zMax = -INF;
+        for (int i = 0; i < count * 8; i++) {
+            vec3 q = corners[i] - apex;
+            float z = -q.dot(d);
+            if (z < EPS)
+                return false;
+            vec2 t(q.dot(r) / z, q.dot(u) / z);
+            tMin.x = min(tMin.x, t.x);
+            tMin.y = min(tMin.y, t.y);
+            tMax.x = max(tMax.x, t.x);
+            tMax.y = max(tMax.y, t.y);
+            zMin = min(zMin, z);
+            zMax = max(zMax, z);
+        }
+
+        mat4 mViewInv = basis;
+        mViewInv.setPos(apex);
+
+        mat4 mProj;
+        mProj.identity();
+        mProj.e00 = 2.0f / (tMax.x - tMin.x);
+        mProj.e02 = (tMax.x + tMin.x) / (tMax.x - tMin.x);
+        mProj.e11 = 2.0f / (tMax.y - tMin.y);
+        mProj.e12 = (tMax.y + tMin.y) / (tMax.y - tMin.y);
+        mProj.e22 = (zMax + zMin) / (zMin - zMax);
+        mProj.e23 = 2.0f * zMax * zMin / (zMin - zMax);
+        mProj.e32 = -1.0f;
+        mProj.e33 = 0.0f;
+
+        Core::mViewInv = mViewInv;
+        Core::setViewProj(mViewInv.inverse(), mProj);
+        Core::viewPos = center;
+        viewRadius    = radius;
+        return true;
+    }
+
+// stereo pair (VR or side-by-side) shares the visibility, culling and the draw list
+    void renderStereo(int view, bool vr, bool showUI) {
+        Texture *oldTarget = Core::defaultTarget;
+        vec4 vp = Core::viewportDef;
+        mat4 views[2], projs[2];
+
+        bool shared = sharedViews;
+        if (shared) {
+            for (int i = 0; i < 2; i++) {
+                if (vr)
+                    Core::eye = i ? 1.0f : -1.0f;
+                else
+                    setViewport(view, i ? 1 : -1, false);
+                setup();
+                views[i] = Core::mView;
+                projs[i] = Core::mProj;
+            }
+            shared = setupSharedView(views, projs, 2);
+        }
+
+        ViewList list;
+        if (shared)
+            cullView(list, camera->getRoomIndex(), true);
+        viewRadius = 0.0f;
+
+        for (int i = 0; i < 2; i++) {
+            if (vr) {
+                Core::defaultTarget = Core::eyeTex[i];
+                Core::viewportDef = vec4(0, 0, float(Core::defaultTarget->width), float(Core::defaultTarget->height));
+                Core::setTarget(NULL, true);
+                Core::eye = i ? 1.0f : -1.0f;
+            } else
+                setViewport(view, i ? 1 : -1, false);
+            setup();
+
+            if (shared)
+                renderViewList(list, true, showUI);
+            else
+                renderView(camera->getRoomIndex(), true, showUI);
+        }
+
+        if (shared)
+            releaseView(list);
+
+        if (vr) {
+            Core::defaultTarget = oldTarget;
+            Core::setTarget(NULL, true);
+            Core::viewportDef = vp;
+        }
+    }
+
     void setupCubeCamera(const vec3 &pos, int face) {
         vec3 up  = vec3(0, -1, 0);
         vec3 dir;
@@ -1737,25 +2645,64 @@ struct Level : IGame {
         camera->frustum->calcPlanes(Core::mViewProj);
     }
 
+    // light matrix and the state of every visible caster, the shadow map is up to date while it's unchanged
+    uint32 getShadowHash(const ViewList &view) {
+        uint32 hash = fnv32((const char*)&Core::mLightProj, sizeof(Core::mLightProj));
+        hash = fnv32((const char*)view.roomsList, sizeof(view.roomsList[0]) * view.roomsCount, hash);
+        for (int i = view.drawFirst; i < view.drawLast; i++) {
+            const DrawItem &item = drawList[i];
+            if (item.type != DRAW_ENTITY) continue;
+            hash = fnv32((const char*)&item.index, sizeof(item.index), hash);
+            hash = ((Controller*)level.entities[item.index].controller)->getShadowHash(hash);
+        }
+        return hash;
+    }
+
     void renderShadows(int roomIndex) {
         PROFILE_MARKER("PASS_SHADOW");
+        double time = getPreciseTime();
+        int    dips = Core::stats.dips;
+
         Core::eye = 0.0f;
         Core::pass = Core::passShadow;
-        shadow->unbind(sShadow);
-        bool colorShadow = shadow->format == Texture::RGBA ? true : false;
-        if (colorShadow)
-            Core::setClearColor(vec4(1.0f));
-        Core::setTarget(shadow, true);
         setupLightCamera();
-        Core::setCulling(cfBack);
-
         setup();
-        renderView(roomIndex, false, false);
 
-        Core::invalidateTarget(!colorShadow, colorShadow);
-        Core::setCulling(cfFront);
-        if (colorShadow)
-            Core::setClearColor(vec4(0.0f));
+        ViewList view;
+        cullView(view, roomIndex, false);
+
+    // split screen players share the shadow map, so it's cached for a single player only
+        uint32 hash = getShadowHash(view);
+        bool   skip = shadowCache && shadowValid && hash == shadowHash && !players[1];
+
+        Core::stats.shadows++;
+
+        if (skip) {
+            Core::stats.shadowsSkipped++;
+            Core::stats.shadowsSavedDips += shadowDips;
+            Core::stats.shadowsSavedTime += max(0.0f, shadowTime - float(getPreciseTime() - time));
+        } else {
+            shadow->unbind(sShadow);
+            bool colorShadow = shadow->format == Texture::RGBA ? true : false;
+            if (colorShadow)
+                Core::setClearColor(vec4(1.0f));
+            Core::setTarget(shadow, true);
+            Core::setCulling(cfBack);
+
+            renderViewList(view, false, false);
+
+            Core::invalidateTarget(!colorShadow, colorShadow);
+            Core::setCulling(cfFront);
+            if (colorShadow)
+                Core::setClearColor(vec4(0.0f));
+
+            shadowValid = true;
+            shadowHash  = hash;
+            shadowDips  = Core::stats.dips - dips;
+            shadowTime  = float(getPreciseTime() - time);
+        }
+
+        releaseView(view);
     }
 
     #ifdef _DEBUG
@@ -1770,6 +2717,32 @@ struct Level : IGame {
             Input::down[ikF] = false;
         }
 
+        if (Input::down[ikK]) { // draw list sorting on/off (compare state changes)
+            sortDraws = !sortDraws;
+            Input::down[ikK] = false;
+        }
+
+        if (Input::down[ikJ]) { // instanced entities on/off (compare draw calls)
+            instancing = !instancing;
+            Input::down[ikJ] = false;
+        }
+
+        if (Input::down[ikN]) { // shared stereo visibility on/off (compare CPU frame time)
+            sharedViews = !sharedViews;
+            Input::down[ikN] = false;
+        }
+
+        if (Input::down[ikU]) { // read phase and parallel poses on/off (compare CPU update time and behaviour)
+            parallelUpdate = !parallelUpdate;
+            Input::down[ikU] = false;
+        }
+
+        if (Input::down[ikG]) { // shadow map cache on/off
+            shadowCache = !shadowCache;
+            shadowValid = false;
+            Input::down[ikG] = false;
+        }
+
         Debug::begin();
         /*
         lara->updateEntity(); // TODO clip angle while rotating
@@ -2039,39 +3012,12 @@ struct Level : IGame {
 
             if (view == 0 && Input::hmd.ready) {
                 Core::settings.detail.vr = true;
-
-                Texture *oldTarget = Core::defaultTarget;
-                vec4 vp = Core::viewportDef;
-
-                Core::defaultTarget = Core::eyeTex[0];
-                Core::viewportDef = vec4(0, 0, float(Core::defaultTarget->width), float(Core::defaultTarget->height));
-                Core::setTarget(NULL, true);
-                Core::eye = -1.0f;
-                setup();
-                renderView(camera->getRoomIndex(), true, false);
-
-                Core::defaultTarget = Core::eyeTex[1];
-                Core::viewportDef = vec4(0, 0, float(Core::defaultTarget->width), float(Core::defaultTarget->height));
-                Core::setTarget(NULL, true);
-                Core::eye =  1.0f;
-                setup();
-                renderView(camera->getRoomIndex(), true, false);
-
+                renderStereo(view, true, false);
                 Core::settings.detail.vr = false;
-
-                Core::defaultTarget = oldTarget;
-                Core::setTarget(NULL, true);
-                Core::viewportDef = vp;
             }   
             
             if (Core::settings.detail.stereo == Core::Settings::STEREO_ON) { // left/right SBS stereo
-                setViewport(view, -1, false);
-                setup();
-                renderView(camera->getRoomIndex(), true, showUI);
-
-                setViewport(view,  1, false);
-                setup();
-                renderView(camera->getRoomIndex(), true, showUI);
+                renderStereo(view, false, showUI);
             } else {
                 setViewport(view,  0, false);
                 setup();
@@ -2185,8 +3131,11 @@ struct Level : IGame {
             inventory.prepareBackground();
         }
 
-        if (!title)
+        if (!title) {
+            frameIndex++;
+            interpolate();
             renderGame(true);
+        }
 
         renderInventory(title);
     }
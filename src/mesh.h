@@ -4,6 +4,8 @@
 #include "core.h"
 #include "format.h"
 
+#define BAKED_VERSION 2 // baked atlas & geometry cache format (see Level::initTextures and MeshBuilder)
+
 TR::ObjectTexture barTile[5 /* UI::BAR_MAX */];
 TR::ObjectTexture &whiteTile = barTile[4]; // BAR_WHITE
 
@@ -303,8 +305,23 @@ struct MeshBuilder {
         Geometry  geometry[3]; // opaque, double-side alpha, additive
         MeshRange sprites;
         int       split;
+    #ifndef SPLIT_BY_TILE
+        int       statics;       // index of the first room static mesh in statics
+        int       staticsCulled; // number of static meshes culled in the current view
+    #endif
     } *rooms;
 
+#ifndef SPLIT_BY_TILE
+// index ranges of the static meshes merged into the room geometry, to skip them individually (see renderRoomGeometry)
+    struct StaticRange {
+        int  iStart[3];
+        int  iCount[3];
+    } *statics;
+    Box  *staticsBox;     // world space visibility boxes
+    bool *staticsVisible; // visibility in the current view
+    int  staticsCount;
+#endif
+
     struct ModelRange {
         int      parts[3][32];
         Geometry geometry[3];
@@ -315,6 +332,25 @@ struct MeshBuilder {
         int       transp;
     } *sequences;
 
+#ifdef MERGE_MODELS
+    #define MAX_INSTANCES 8
+
+// model geometry copies for instanced rendering, joint indices of the copy k are offset by k * mCount
+    struct InstanceRange {
+        MeshRange geometry[3];
+        int       count;
+    } *instances;
+    Mesh *instMesh;
+#endif
+
+// level geometry before upload
+    struct Buffer {
+        Index  *indices;
+        Vertex *vertices;
+        int    iCount, vCount, aCount;
+        int    vStartModel, vStartSprite, vStartCommon;
+    } buffer;
+
 // procedured
     MeshRange shadowBlob;
     MeshRange quad, circle;
@@ -328,39 +364,105 @@ struct MeshBuilder {
 
     int transparent;
 
+    TR::ObjectTexture whiteTile; // of the level being built, the global one belongs to the rendered level until Level::init
+
     enum {
         BLEND_NONE  = 1,
         BLEND_ALPHA = 2,
         BLEND_ADD   = 4,
     };
 
-    MeshBuilder(TR::Level &level, Texture *atlas) : atlas(atlas), level(&level) {
+// geometry only (CPU), call upload to create GPU buffers
+    MeshBuilder(TR::Level &level, const TR::ObjectTexture &white) : mesh(NULL), atlas(NULL), level(&level), whiteTile(white) {
+        init(level);
+    }
+
+    MeshBuilder(TR::Level &level, const TR::ObjectTexture &white, Texture *atlas) : mesh(NULL), atlas(NULL), level(&level), whiteTile(white) {
+        init(level);
+        upload(atlas);
+    }
+
+    void init(TR::Level &level) {
     #ifndef _PSP
-        dynMesh = new Mesh(NULL, DYN_MESH_QUADS * 6, NULL, DYN_MESH_QUADS * 4, 1);
-        dynRange.vStart = 0;
-        dynRange.iStart = 0;
-        dynMesh->initRange(dynRange);
+        dynMesh = NULL;
+    #endif
+    #ifdef MERGE_MODELS
+        instances = NULL;
+        instMesh  = NULL;
     #endif
 
         initAnimTextures(level);
 
-    // allocate room geometry ranges
-        rooms = new RoomRange[level.roomsCount];
+        rooms     = new RoomRange[level.roomsCount];
+        models    = new ModelRange[level.modelsCount];
+        sequences = new SpriteRange[level.spriteSequencesCount];
+
+    #ifndef SPLIT_BY_TILE
+        staticsCount = 0;
+        for (int i = 0; i < level.roomsCount; i++)
+            staticsCount += level.rooms[i].meshesCount;
+        statics        = new StaticRange[staticsCount];
+        staticsBox     = new Box[staticsCount];
+        staticsVisible = new bool[staticsCount];
+    #endif
+
+    // baked geometry depends on water surfaces removal
+        char fileName[sizeof(Stream::cacheDir) + 32];
+        if (Stream::cacheDir[0])
+            sprintf(fileName, "%s%08X_%d.xmb", Stream::cacheDir, level.hash, int(Core::settings.detail.water > Core::Settings::LOW));
+        else
+            fileName[0] = 0;
+
+        if (!(fileName[0] && loadBaked(fileName, buffer))) {
+            build(buffer);
+            if (fileName[0])
+                saveBaked(fileName, buffer);
+        }
+
+    #ifndef SPLIT_BY_TILE
+        initStatics(level);
+    #endif
+    }
+
+#ifndef SPLIT_BY_TILE
+    void initStatics(TR::Level &level) {
+        int index = 0;
+        for (int i = 0; i < level.roomsCount; i++) {
+            TR::Room &room = level.rooms[i];
+            rooms[i].statics       = index;
+            rooms[i].staticsCulled = 0;
+
+            for (int j = 0; j < room.meshesCount; j++) {
+                TR::Room::Mesh &m = room.meshes[j];
+                Box &box = staticsBox[index];
+                level.staticMeshes[m.meshIndex].getBox(false, m.rotation, box);
+                box.translate(vec3(float(m.x), float(m.y), float(m.z)));
+                staticsVisible[index++] = true;
+            }
+        }
+    }
+#endif
+
+    void build(Buffer &buf) {
+        TR::Level &level = *this->level;
 
         int iCount = 0, vCount = 0;
 
+        TR::Face::Cmp faceCmp(level.objectTextures, level.objectTexturesCount);
+        TR::Room::Data::Sprite::Cmp spriteCmp(level.spriteTextures, level.spriteTexturesCount);
+
     // sort room faces by material
         for (int i = 0; i < level.roomsCount; i++) {
             TR::Room::Data &data = level.rooms[i].data;
-            sort(data.faces, data.fCount);
+            sort(data.faces, data.fCount, faceCmp);
         // sort room sprites by material
-            sort(data.sprites, data.sCount);
+            sort(data.sprites, data.sCount, spriteCmp);
         }
 
     // sort mesh faces by material
         for (int i = 0; i < level.meshesCount; i++) {
             TR::Mesh &mesh = level.meshes[i];
-            sort(mesh.faces, mesh.fCount);
+            sort(mesh.faces, mesh.fCount, faceCmp);
         }
 
     // get size of mesh for rooms (geometry & sprites)
@@ -401,7 +503,6 @@ struct MeshBuilder {
         }
 
     // get models info
-        models = new ModelRange[level.modelsCount];
         for (int i = 0; i < level.modelsCount; i++) {
             TR::Model &model = level.models[i];
             for (int j = 0; j < model.mCount; j++) {
@@ -415,7 +516,6 @@ struct MeshBuilder {
         }
 
     // get size of mesh for sprite sequences
-        sequences = new SpriteRange[level.spriteSequencesCount];
         for (int i = 0; i < level.spriteSequencesCount; i++) {
             sequences[i].transp = 1; // alpha blending by default
         #ifdef MERGE_SPRITES
@@ -452,6 +552,10 @@ struct MeshBuilder {
         vStartRoom = vCount;
         aCount++;
 
+    #ifndef SPLIT_BY_TILE
+        int staticsStart = 0;
+    #endif
+
         for (int i = 0; i < level.roomsCount; i++) {
             TR::Room &room = level.rooms[i];
             TR::Room::Data &d = room.data;
@@ -474,6 +578,11 @@ struct MeshBuilder {
                 for (int j = 0; j < room.meshesCount; j++) {
                     TR::Room::Mesh &m = room.meshes[j];
                     TR::StaticMesh *s = &level.staticMeshes[m.meshIndex];
+                #ifndef SPLIT_BY_TILE
+                    StaticRange &sr = statics[staticsStart + j];
+                    sr.iStart[transp] = iCount;
+                    sr.iCount[transp] = 0;
+                #endif
                     if (!level.meshOffsets[s->mesh]) continue;
                     TR::Mesh &mesh = level.meshes[level.meshOffsets[s->mesh]];
 
@@ -482,10 +591,16 @@ struct MeshBuilder {
                     int z = m.z - room.info.z;
                     int d = m.rotation.value / 0x4000;
                     buildMesh(geom, blendMask, mesh, level, indices, vertices, iCount, vCount, vStartRoom, 0, x, y, z, d, m.color);
+                #ifndef SPLIT_BY_TILE
+                    sr.iCount[transp] = iCount - sr.iStart[transp];
+                #endif
                 }
 
                 geom.finish(iCount);
             }
+        #ifndef SPLIT_BY_TILE
+            staticsStart += room.meshesCount;
+        #endif
 
         // rooms sprites
         #ifdef MERGE_SPRITES
@@ -713,10 +828,42 @@ struct MeshBuilder {
 
         LOG("MegaMesh (i:%d v:%d a:%d)\n", iCount, vCount, aCount);
 
+        buf.indices      = indices;
+        buf.vertices     = vertices;
+        buf.iCount       = iCount;
+        buf.vCount       = vCount;
+        buf.aCount       = aCount;
+        buf.vStartModel  = vStartModel;
+    #ifdef MERGE_SPRITES
+        buf.vStartSprite = vStartSprite;
+    #else
+        buf.vStartSprite = 0;
+    #endif
+        buf.vStartCommon = vStartCommon;
+    }
+
+    void upload(Texture *atlas) {
+        this->atlas = atlas;
+
+    #ifndef _PSP
+        dynMesh = new Mesh(NULL, DYN_MESH_QUADS * 6, NULL, DYN_MESH_QUADS * 4, 1);
+        dynRange.vStart = 0;
+        dynRange.iStart = 0;
+        dynMesh->initRange(dynRange);
+    #endif
+
+        Buffer &buf = buffer;
+
+    #ifdef MERGE_MODELS
+        initInstances(buf);
+    #endif
+
     // compile buffer and ranges
-        mesh = new Mesh(indices, iCount, vertices, vCount, aCount);
-        delete[] indices;
-        delete[] vertices;
+        mesh = new Mesh(buf.indices, buf.iCount, buf.vertices, buf.vCount, buf.aCount);
+        delete[] buf.indices;
+        delete[] buf.vertices;
+        buf.indices  = NULL;
+        buf.vertices = NULL;
 
         PROFILE_LABEL(BUFFER, mesh->ID[0], "Geometry indices");
         PROFILE_LABEL(BUFFER, mesh->ID[1], "Geometry vertices");
@@ -725,7 +872,7 @@ struct MeshBuilder {
         MeshRange rangeRoom;
         rangeRoom.vStart = 0;
         mesh->initRange(rangeRoom);
-        for (int i = 0; i < level.roomsCount; i++) {
+        for (int i = 0; i < level->roomsCount; i++) {
             
             if (rooms[i].split) {
                 ASSERT(rooms[i].geometry[0].count);
@@ -742,9 +889,9 @@ struct MeshBuilder {
         }
 
         MeshRange rangeModel;
-        rangeModel.vStart = vStartModel;
+        rangeModel.vStart = buf.vStartModel;
         mesh->initRange(rangeModel);
-        for (int i = 0; i < level.modelsCount; i++)
+        for (int i = 0; i < level->modelsCount; i++)
             for (int j = 0; j < 3; j++) {
                 Geometry &geom = models[i].geometry[j];
                 for (int k = 0; k < geom.count; k++)
@@ -753,14 +900,14 @@ struct MeshBuilder {
 
     #ifdef MERGE_SPRITES
         MeshRange rangeSprite;
-        rangeSprite.vStart = vStartSprite;
+        rangeSprite.vStart = buf.vStartSprite;
         mesh->initRange(rangeSprite);
-        for (int i = 0; i < level.spriteSequencesCount; i++)
+        for (int i = 0; i < level->spriteSequencesCount; i++)
             sequences[i].sprites.aIndex = rangeSprite.aIndex;
     #endif
 
         MeshRange rangeCommon;
-        rangeCommon.vStart = vStartCommon;
+        rangeCommon.vStart = buf.vStartCommon;
         mesh->initRange(rangeCommon);
         shadowBlob.aIndex = rangeCommon.aIndex;
         quad.aIndex       = rangeCommon.aIndex;
@@ -768,18 +915,359 @@ struct MeshBuilder {
         plane.aIndex      = rangeCommon.aIndex;
     }
 
+// baked geometry: header, room water levels, range tables and index/vertex buffers
+    static int32 getBakedFlags() {
+        int32 flags = 0;
+    #ifdef SPLIT_BY_TILE
+        flags |= 1;
+    #endif
+    #ifdef SPLIT_BY_CLUT
+        flags |= 2;
+    #endif
+    #ifdef MERGE_MODELS
+        flags |= 4;
+    #endif
+    #ifdef MERGE_SPRITES
+        flags |= 8;
+    #endif
+    #ifdef GENERATE_WATER_PLANE
+        flags |= 16;
+    #endif
+        return flags;
+    }
+
+    void writeGeometry(char *&ptr, const Geometry &geom) {
+        memcpy(ptr, &geom.count, sizeof(geom.count));
+        ptr += sizeof(geom.count);
+        memcpy(ptr, geom.ranges, geom.count * sizeof(MeshRange));
+        ptr += geom.count * sizeof(MeshRange);
+    }
+
+    bool readGeometry(Stream &stream, Geometry &geom) {
+        stream.read(geom.count);
+        if (geom.count < 0 || geom.count > int(COUNT(geom.ranges)) || stream.pos + geom.count * int(sizeof(MeshRange)) > stream.size)
+            return false;
+        stream.raw(geom.ranges, geom.count * sizeof(MeshRange));
+        return true;
+    }
+
+    void saveBaked(const char *fileName, const Buffer &buf) {
+        int32 header[] = { int32(FOURCC("OLMB")), BAKED_VERSION, getBakedFlags(), sizeof(Vertex),
+                           level->roomsCount, level->modelsCount, level->spriteSequencesCount,
+                           buf.iCount, buf.vCount, buf.aCount, buf.vStartModel, buf.vStartSprite, buf.vStartCommon };
+
+        int size = sizeof(header)
+                 + level->roomsCount * (sizeof(uint32) + sizeof(RoomRange))
+            #ifndef SPLIT_BY_TILE
+                 + staticsCount * sizeof(int32) * 6
+            #endif
+                 + level->modelsCount * sizeof(ModelRange)
+                 + level->spriteSequencesCount * sizeof(SpriteRange)
+                 + sizeof(MeshRange) * 4
+                 + buf.iCount * sizeof(Index)
+                 + buf.vCount * sizeof(Vertex);
+
+        char *data = new char[size];
+        char *ptr  = data;
+
+        memcpy(ptr, header, sizeof(header));
+        ptr += sizeof(header);
+
+        for (int i = 0; i < level->roomsCount; i++) {
+            RoomRange &r = rooms[i];
+            memcpy(ptr, &level->rooms[i].waterLevel, sizeof(uint32));
+            ptr += sizeof(uint32);
+            memcpy(ptr, &r.sprites, sizeof(r.sprites));
+            ptr += sizeof(r.sprites);
+            memcpy(ptr, &r.split, sizeof(r.split));
+            ptr += sizeof(r.split);
+            for (int j = 0; j < 3; j++)
+                writeGeometry(ptr, r.geometry[j]);
+        }
+
+    #ifndef SPLIT_BY_TILE
+        for (int i = 0; i < staticsCount; i++) {
+            StaticRange &s = statics[i];
+            memcpy(ptr, s.iStart, sizeof(s.iStart));
+            ptr += sizeof(s.iStart);
+            memcpy(ptr, s.iCount, sizeof(s.iCount));
+            ptr += sizeof(s.iCount);
+        }
+    #endif
+
+        for (int i = 0; i < level->modelsCount; i++) {
+            ModelRange &m = models[i];
+            memcpy(ptr, m.parts, sizeof(m.parts));
+            ptr += sizeof(m.parts);
+            for (int j = 0; j < 3; j++)
+                writeGeometry(ptr, m.geometry[j]);
+        }
+
+        memcpy(ptr, sequences, level->spriteSequencesCount * sizeof(SpriteRange));
+        ptr += level->spriteSequencesCount * sizeof(SpriteRange);
+
+        const MeshRange *common[] = { &shadowBlob, &quad, &circle, &plane };
+        for (int i = 0; i < int(COUNT(common)); i++) {
+            memcpy(ptr, common[i], sizeof(MeshRange));
+            ptr += sizeof(MeshRange);
+        }
+
+        memcpy(ptr, buf.indices, buf.iCount * sizeof(Index));
+        ptr += buf.iCount * sizeof(Index);
+        memcpy(ptr, buf.vertices, buf.vCount * sizeof(Vertex));
+        ptr += buf.vCount * sizeof(Vertex);
+
+        Stream::write(fileName, data, int(ptr - data));
+        delete[] data;
+    }
+
+    bool loadBaked(const char *fileName, Buffer &buf) {
+        if (!Stream::exists(fileName))
+            return false;
+
+        Stream stream(fileName);
+
+        int32 header[13];
+        if (stream.size < int(sizeof(header)))
+            return false;
+        stream.raw(header, sizeof(header));
+
+        if (header[0] != int32(FOURCC("OLMB")) || header[1] != BAKED_VERSION || header[2] != getBakedFlags() || header[3] != sizeof(Vertex) ||
+            header[4] != level->roomsCount || header[5] != level->modelsCount || header[6] != level->spriteSequencesCount) {
+            LOG("! invalid baked geometry \"%s\"\n", fileName);
+            return false;
+        }
+
+        bool valid = true;
+        uint32 *waterLevel = new uint32[level->roomsCount];
+
+        for (int i = 0; i < level->roomsCount && valid; i++) {
+            RoomRange &r = rooms[i];
+            stream.read(waterLevel[i]);
+            stream.read(r.sprites);
+            stream.read(r.split);
+            for (int j = 0; j < 3 && valid; j++)
+                valid = readGeometry(stream, r.geometry[j]);
+        }
+
+    #ifndef SPLIT_BY_TILE
+        if (valid && stream.pos + staticsCount * int(sizeof(int32) * 6) > stream.size)
+            valid = false;
+
+        for (int i = 0; i < staticsCount && valid; i++) {
+            StaticRange &s = statics[i];
+            stream.raw(s.iStart, sizeof(s.iStart));
+            stream.raw(s.iCount, sizeof(s.iCount));
+        }
+    #endif
+
+        for (int i = 0; i < level->modelsCount && valid; i++) {
+            ModelRange &m = models[i];
+            stream.raw(m.parts, sizeof(m.parts));
+            for (int j = 0; j < 3 && valid; j++)
+                valid = readGeometry(stream, m.geometry[j]);
+        }
+
+        buf.iCount       = header[7];
+        buf.vCount       = header[8];
+        buf.aCount       = header[9];
+        buf.vStartModel  = header[10];
+        buf.vStartSprite = header[11];
+        buf.vStartCommon = header[12];
+
+        if (!valid || stream.size - stream.pos != int(level->spriteSequencesCount * sizeof(SpriteRange) + sizeof(MeshRange) * 4 + buf.iCount * sizeof(Index) + buf.vCount * sizeof(Vertex))) {
+            LOG("! invalid baked geometry \"%s\"\n", fileName);
+        // reset partially loaded ranges
+            delete[] rooms;
+            delete[] models;
+            rooms  = new RoomRange[level->roomsCount];
+            models = new ModelRange[level->modelsCount];
+            delete[] waterLevel;
+            return false;
+        }
+
+    // build() also sorts the faces by material and marks the removed water surfaces, but nothing else reads the faces
+    // (a rebuild on settings change sorts and marks them itself), so only the water level used by the rendering is restored
+        for (int i = 0; i < level->roomsCount; i++)
+            level->rooms[i].waterLevel = waterLevel[i];
+        delete[] waterLevel;
+
+        stream.raw(sequences, level->spriteSequencesCount * sizeof(SpriteRange));
+        stream.read(shadowBlob);
+        stream.read(quad);
+        stream.read(circle);
+        stream.read(plane);
+        stream.read(buf.indices,  buf.iCount);
+        stream.read(buf.vertices, buf.vCount);
+
+        LOG("MegaMesh (i:%d v:%d a:%d) baked\n", buf.iCount, buf.vCount, buf.aCount);
+        return true;
+    }
+
     ~MeshBuilder() {
+        delete[] buffer.indices;
+        delete[] buffer.vertices;
         delete[] animTexRanges;
         delete[] animTexOffsets;
         delete[] rooms;
         delete[] models;
         delete[] sequences;
+    #ifndef SPLIT_BY_TILE
+        delete[] statics;
+        delete[] staticsBox;
+        delete[] staticsVisible;
+    #endif
         delete mesh;
     #ifndef _PSP
         delete dynMesh;
     #endif
+    #ifdef MERGE_MODELS
+        delete[] instances;
+        delete instMesh;
+    #endif
     }
 
+#ifdef MERGE_MODELS
+// replicate geometry of the small models used by several entities (or spawned at runtime)
+    void initInstances(const Buffer &buf) {
+        TR::Level &level = *this->level;
+
+        instances = new InstanceRange[level.modelsCount];
+
+        int *usage = new int[level.modelsCount];
+        memset(usage, 0, level.modelsCount * sizeof(int));
+        for (int i = 0; i < level.entitiesBaseCount; i++) {
+            int modelIndex = level.entities[i].modelIndex - 1;
+            if (modelIndex >= 0)
+                usage[modelIndex]++;
+        }
+
+        int iCount = 0, vCount = 0;
+
+        for (int pass = 0; pass < 2; pass++) { // get size, build
+            Index  *indices  = NULL;
+            Vertex *vertices = NULL;
+
+            if (pass) {
+                if (!iCount) break;
+                indices  = new Index[iCount];
+                vertices = new Vertex[vCount];
+                iCount = vCount = 0;
+            }
+
+            for (int i = 0; i < level.modelsCount; i++) {
+                TR::Model &model = level.models[i];
+                InstanceRange &inst = instances[i];
+
+                if (!pass) {
+                    inst.count = 0;
+
+                    if (!model.mCount || (usage[i] < 2 && model.type != TR::Entity::DART))
+                        continue;
+
+                    inst.count = min(MAX_INSTANCES, 32 / int(model.mCount));
+                    if (inst.count < 2) {
+                        inst.count = 0;
+                        continue;
+                    }
+                }
+
+                if (!inst.count) continue;
+
+                int iCountModel = 0, vCountModel = 0;
+                int vMin[3], vMax[3];
+
+                for (int transp = 0; transp < 3; transp++) {
+                    Geometry &geom = models[i].geometry[transp];
+                    vMin[transp] = 0xFFFF;
+                    vMax[transp] = -1;
+                    if (!geom.count) continue;
+
+                    ASSERT(geom.count == 1);
+                    MeshRange &range = geom.ranges[0];
+                    for (int j = 0; j < range.iCount; j++) {
+                        int index = buf.indices[range.iStart + j];
+                        vMin[transp] = min(vMin[transp], index);
+                        vMax[transp] = max(vMax[transp], index);
+                    }
+
+                    if (vMax[transp] >= vMin[transp]) {
+                        iCountModel += range.iCount;
+                        vCountModel += vMax[transp] - vMin[transp] + 1;
+                    }
+                }
+
+                if (!pass) {
+                    if (!iCountModel || vCount + vCountModel * inst.count > 0xFFFF) {
+                        inst.count = 0;
+                        continue;
+                    }
+                    iCount += iCountModel * inst.count;
+                    vCount += vCountModel * inst.count;
+                    continue;
+                }
+
+                for (int transp = 0; transp < 3; transp++) {
+                    MeshRange &dst = inst.geometry[transp];
+                    dst.iStart = iCount;
+                    dst.iCount = 0;
+                    dst.vStart = 0;
+
+                    if (vMax[transp] < vMin[transp]) continue;
+
+                    MeshRange &range = models[i].geometry[transp].ranges[0];
+                    const Vertex *src = buf.vertices + range.vStart + vMin[transp];
+                    int vSpan = vMax[transp] - vMin[transp] + 1;
+
+                    for (int k = 0; k < inst.count; k++) {
+                        for (int j = 0; j < range.iCount; j++)
+                            indices[iCount++] = Index(buf.indices[range.iStart + j] - vMin[transp] + vCount);
+
+                        for (int j = 0; j < vSpan; j++) {
+                            Vertex &v = vertices[vCount++];
+                            v = src[j];
+                            v.coord.w += k * model.mCount;
+                        }
+                    }
+
+                    dst.iCount = range.iCount; // per instance
+                }
+            }
+
+            if (pass) {
+                instMesh = new Mesh(indices, iCount, vertices, vCount, 1);
+                delete[] indices;
+                delete[] vertices;
+
+                MeshRange rangeInst;
+                instMesh->initRange(rangeInst);
+                for (int i = 0; i < level.modelsCount; i++)
+                    for (int j = 0; j < 3; j++)
+                        instances[i].geometry[j].aIndex = rangeInst.aIndex;
+            }
+        }
+
+        delete[] usage;
+
+        LOG("instances (i:%d v:%d)\n", iCount, vCount);
+    }
+
+    int getInstancesCount(int modelIndex) const {
+        return instMesh ? instances[modelIndex].count : 0;
+    }
+
+// count copies of the model with joints at Core::active.basis[k * mCount]
+    void renderModelInstances(int modelIndex, int count) {
+        ASSERT(count <= instances[modelIndex].count);
+        ASSERT(level->models[modelIndex].mCount * count == Core::active.basisCount);
+
+        MeshRange range = instances[modelIndex].geometry[transparent];
+        if (!range.iCount) return;
+        range.iCount *= count;
+        instMesh->render(range);
+    }
+#endif
+
     inline short4 rotate(const short4 &v, int dir) {
         if (dir == 0) return v;
         short4 res = v;
@@ -1263,7 +1751,7 @@ struct MeshBuilder {
         dynMesh->render(dynRange);
     }
 
-    void renderRoomGeometry(int roomIndex) {
+    void renderRoomGeometry(int roomIndex, bool clipStatics = false) {
         Geometry &geom = rooms[roomIndex].geometry[transparent];
         for (int i = 0; i < geom.count; i++) {
             MeshRange &range = geom.ranges[i];
@@ -1271,12 +1759,40 @@ struct MeshBuilder {
         #ifdef SPLIT_BY_TILE
             int clutOffset = level->rooms[roomIndex].flags.water ? 512 : 0;
             atlas->bind(range.tile, range.clut + clutOffset);
+        #else
+            if (clipStatics && rooms[roomIndex].staticsCulled) {
+                renderRoomRange(roomIndex, range);
+                continue;
+            }
         #endif
 
             mesh->render(range);
         }
     }
 
+#ifndef SPLIT_BY_TILE
+// render the room range around the culled static meshes
+    void renderRoomRange(int roomIndex, const MeshRange &range) {
+        MeshRange part = range;
+        int end = range.iStart + range.iCount;
+
+        int first = rooms[roomIndex].statics;
+        for (int j = 0; j < level->rooms[roomIndex].meshesCount; j++) {
+            const StaticRange *s = statics + first + j;
+            if (staticsVisible[first + j] || !s->iCount[transparent])
+                continue;
+            part.iCount = s->iStart[transparent] - part.iStart;
+            if (part.iCount)
+                mesh->render(part);
+            part.iStart = s->iStart[transparent] + s->iCount[transparent];
+        }
+
+        part.iCount = end - part.iStart;
+        if (part.iCount)
+            mesh->render(part);
+    }
+#endif
+
     void renderRoomSprites(int roomIndex) {
     #ifndef MERGE_SPRITES
         #ifdef SPLIT_BY_TILE
@@ -0,0 +1,1010 @@
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "game.h"
+
+// headless: GL entry points are stubbed, the benchmark never creates a context
+#define GL_STUB(result, name, args) extern "C" result name args { return result(); }
+
+typedef const GLubyte* GLString;
+typedef void (*GLProc)();
+
+GL_STUB(void,            glActiveTexture,     (GLenum))
+GL_STUB(void,            glBindTexture,       (GLenum, GLuint))
+GL_STUB(void,            glGenTextures,       (GLsizei, GLuint*))
+GL_STUB(void,            glDeleteTextures,    (GLsizei, const GLuint*))
+GL_STUB(void,            glTexImage2D,        (GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const GLvoid*))
+GL_STUB(void,            glTexParameteri,     (GLenum, GLenum, GLint))
+GL_STUB(void,            glTexParameterfv,    (GLenum, GLenum, const GLfloat*))
+GL_STUB(void,            glCopyTexSubImage2D, (GLenum, GLint, GLint, GLint, GLint, GLint, GLsizei, GLsizei))
+GL_STUB(void,            glReadPixels,        (GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, GLvoid*))
+GL_STUB(GLString,        glGetString,         (GLenum))
+GL_STUB(void,            glGetIntegerv,       (GLenum, GLint*))
+GL_STUB(void,            glEnable,            (GLenum))
+GL_STUB(void,            glDisable,           (GLenum))
+GL_STUB(void,            glBlendFunc,         (GLenum, GLenum))
+GL_STUB(void,            glCullFace,          (GLenum))
+GL_STUB(void,            glDepthMask,         (GLboolean))
+GL_STUB(void,            glDepthFunc,         (GLenum))
+GL_STUB(void,            glColorMask,         (GLboolean, GLboolean, GLboolean, GLboolean))
+GL_STUB(void,            glViewport,          (GLint, GLint, GLsizei, GLsizei))
+GL_STUB(void,            glClearColor,        (GLclampf, GLclampf, GLclampf, GLclampf))
+GL_STUB(void,            glClear,             (GLbitfield))
+GL_STUB(void,            glDrawElements,      (GLenum, GLsizei, GLenum, const GLvoid*))
+GL_STUB(GLProc,          glXGetProcAddress,   (const GLubyte*))
+
+// multi-threading
+void* osMutexInit() {
+    pthread_mutex_t *mutex = new pthread_mutex_t();
+    pthread_mutex_init(mutex, NULL);
+    return mutex;
+}
+
+void osMutexFree(void *obj) {
+    pthread_mutex_destroy((pthread_mutex_t*)obj);
+    delete (pthread_mutex_t*)obj;
+}
+
+void osMutexLock(void *obj) {
+    pthread_mutex_lock((pthread_mutex_t*)obj);
+}
+
+void osMutexUnlock(void *obj) {
+    pthread_mutex_unlock((pthread_mutex_t*)obj);
+}
+
+void* osRWLockInit() {
+    pthread_rwlock_t *lock = new pthread_rwlock_t();
+    pthread_rwlock_init(lock, NULL);
+    return lock;
+}
+
+void osRWLockFree(void *obj) {
+    pthread_rwlock_destroy((pthread_rwlock_t*)obj);
+    delete (pthread_rwlock_t*)obj;
+}
+
+void osRWLockRead(void *obj) {
+    pthread_rwlock_rdlock((pthread_rwlock_t*)obj);
+}
+
+void osRWUnlockRead(void *obj) {
+    pthread_rwlock_unlock((pthread_rwlock_t*)obj);
+}
+
+void osRWLockWrite(void *obj) {
+    pthread_rwlock_wrlock((pthread_rwlock_t*)obj);
+}
+
+void osRWUnlockWrite(void *obj) {
+    pthread_rwlock_unlock((pthread_rwlock_t*)obj);
+}
+
+void* osThreadCreate(ThreadProc *proc, void *arg) {
+    pthread_t *thread = new pthread_t();
+    pthread_create(thread, NULL, proc, arg);
+    return thread;
+}
+
+void osThreadJoin(void *obj) {
+    pthread_join(*(pthread_t*)obj, NULL);
+    delete (pthread_t*)obj;
+}
+
+int osGetCPUCount() {
+    return max(int(sysconf(_SC_NPROCESSORS_ONLN)), 1);
+}
+
+struct OSEvent {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            signaled;
+};
+
+void* osEventInit() {
+    OSEvent *e = new OSEvent();
+    pthread_mutex_init(&e->mutex, NULL);
+    pthread_cond_init(&e->cond, NULL);
+    e->signaled = false;
+    return e;
+}
+
+void osEventFree(void *obj) {
+    OSEvent *e = (OSEvent*)obj;
+    pthread_cond_destroy(&e->cond);
+    pthread_mutex_destroy(&e->mutex);
+    delete e;
+}
+
+void osEventSignal(void *obj) {
+    OSEvent *e = (OSEvent*)obj;
+    pthread_mutex_lock(&e->mutex);
+    e->signaled = true;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->mutex);
+}
+
+void osEventWait(void *obj) {
+    OSEvent *e = (OSEvent*)obj;
+    pthread_mutex_lock(&e->mutex);
+    while (!e->signaled)
+        pthread_cond_wait(&e->cond, &e->mutex);
+    e->signaled = false;
+    pthread_mutex_unlock(&e->mutex);
+}
+
+// timing
+int osGetTime() {
+    return int(getPreciseTime());
+}
+
+bool osSave(const char *name, const void *data, int size) {
+    FILE *f = fopen(name, "wb");
+    if (!f) return false;
+    fwrite(data, size, 1, f);
+    fclose(f);
+    return true;
+}
+
+char Stream::cacheDir[255];
+char Stream::contentDir[255];
+
+// tile conversion micro-benchmarks
+#define BENCH_TILES   16
+#define BENCH_REPEAT  8
+
+struct TileBench {
+    TR::Tile8   *tiles8;
+    TR::Tile16  *tiles16;
+    TR::Tile4   *tiles4;
+    TR::Tile32  *ref, *out;
+    TR::Color24 palette[256];
+    TR::CLUT    clut;
+    uint32      lut[256];
+
+    TileBench() {
+        tiles8  = new TR::Tile8[BENCH_TILES];
+        tiles16 = new TR::Tile16[BENCH_TILES];
+        tiles4  = new TR::Tile4[BENCH_TILES];
+        ref     = new TR::Tile32[BENCH_TILES];
+        out     = new TR::Tile32[BENCH_TILES];
+
+        srand(0);
+        for (int i = 0; i < BENCH_TILES; i++) {
+            for (int j = 0; j < 256 * 256; j++) {
+                tiles8[i].index[j]        = rand() & 0xFF;
+                tiles16[i].color[j].value = rand() & 0xFFFF;
+            }
+            for (int j = 0; j < 256 * 256 / 2; j++)
+                ((uint8*)tiles4[i].index)[j] = rand() & 0xFF;
+        }
+
+        for (int i = 0; i < 256; i++)
+            palette[i] = TR::Color24(rand() & 0xFC, rand() & 0xFC, rand() & 0xFC);
+        for (int i = 0; i < 16; i++)
+            clut.color[i].value = rand() & 0xFFFF;
+
+        lut[0] = 0;
+        for (int i = 1; i < 256; i++)
+            lut[i] = palette[i].r | (palette[i].g << 8) | (palette[i].b << 16) | 0xFF000000;
+    }
+
+    ~TileBench() {
+        delete[] tiles8;
+        delete[] tiles16;
+        delete[] tiles4;
+        delete[] ref;
+        delete[] out;
+    }
+
+    // reference per-pixel loops (pre-kernel loader code)
+    void refTiles8() {
+        for (int i = 0; i < BENCH_TILES; i++) {
+            TR::Color32 *ptr = ref[i].color;
+            for (int j = 0; j < 256 * 256; j++) {
+                uint8 index = tiles8[i].index[j];
+                TR::Color24 &p = palette[index];
+                if (index != 0) {
+                    ptr[j].r = p.r;
+                    ptr[j].g = p.g;
+                    ptr[j].b = p.b;
+                    ptr[j].a = 255;
+                } else
+                    ptr[j].r = ptr[j].g = ptr[j].b = ptr[j].a = 0;
+            }
+        }
+    }
+
+    void refTiles16() {
+        for (int i = 0; i < BENCH_TILES; i++)
+            for (int j = 0; j < 256 * 256; j++) {
+                TR::Color32 c = tiles16[i].color[j];
+                ref[i].color[j] = TR::Color32(c.b, c.g, c.r, c.a);
+            }
+    }
+
+    void refTiles4(int minX, int minY, int maxX, int maxY) {
+        for (int i = 0; i < BENCH_TILES; i++)
+            for (int y = minY; y <= maxY; y++)
+                for (int x = minX; x <= maxX; x++)
+                    ref[i].color[y * 256 + x] = clut.color[(x % 2) ? tiles4[i].index[(y * 256 + x) / 2].b : tiles4[i].index[(y * 256 + x) / 2].a];
+    }
+
+    void newTiles8() {
+        for (int i = 0; i < BENCH_TILES; i++)
+            TR::Level::convertTile8(out[i], tiles8[i], lut);
+    }
+
+    void newTiles16() {
+        for (int i = 0; i < BENCH_TILES; i++)
+            TR::Level::convertTile16(out[i], tiles16[i]);
+    }
+
+    void newTiles4(int minX, int minY, int maxX, int maxY) {
+        for (int i = 0; i < BENCH_TILES; i++)
+            TR::Level::convertRect4(out[i], tiles4[i], clut, minX, minY, maxX, maxY);
+    }
+
+    static void jobTiles8(void *userData, int start, int end) {
+        TileBench *b = (TileBench*)userData;
+        for (int i = start; i < end; i++)
+            TR::Level::convertTile8(b->out[i], b->tiles8[i], b->lut);
+    }
+
+    static void jobTiles16(void *userData, int start, int end) {
+        TileBench *b = (TileBench*)userData;
+        for (int i = start; i < end; i++)
+            TR::Level::convertTile16(b->out[i], b->tiles16[i]);
+    }
+
+    bool equal() {
+        return memcmp(ref, out, sizeof(TR::Tile32) * BENCH_TILES) == 0;
+    }
+
+    void report(const char *name, double ms, double base) {
+        LOG("%-16s %8.3f ms/tile  x%.2f\n", name, ms / (BENCH_TILES * BENCH_REPEAT), base / ms);
+    }
+
+    void run() {
+        double t, base;
+
+        #define MEASURE(expr) t = getPreciseTime(); for (int r = 0; r < BENCH_REPEAT; r++) { expr; } t = getPreciseTime() - t;
+
+        LOG("tiles: %d x %d, threads: %d\n", BENCH_TILES, BENCH_REPEAT, min(osGetCPUCount(), MAX_JOB_THREADS));
+
+        MEASURE(refTiles8());  base = t; report("tile8 ref", t, base);
+        MEASURE(newTiles8());  report("tile8 lut", t, base);
+        LOG("  match: %s\n", equal() ? "yes" : "NO");
+        MEASURE(parallelFor(BENCH_TILES, jobTiles8, this)); report("tile8 parallel", t, base);
+        LOG("  match: %s\n", equal() ? "yes" : "NO");
+
+        MEASURE(refTiles16()); base = t; report("tile16 ref", t, base);
+        MEASURE(newTiles16()); report("tile16 kernel", t, base);
+        LOG("  match: %s\n", equal() ? "yes" : "NO");
+        MEASURE(parallelFor(BENCH_TILES, jobTiles16, this)); report("tile16 parallel", t, base);
+        LOG("  match: %s\n", equal() ? "yes" : "NO");
+
+        memset((void*)ref, 0, sizeof(TR::Tile32) * BENCH_TILES);
+        memset((void*)out, 0, sizeof(TR::Tile32) * BENCH_TILES);
+        MEASURE(refTiles4(3, 5, 250, 200)); base = t; report("tile4 ref", t, base);
+        MEASURE(newTiles4(3, 5, 250, 200)); report("tile4 lut", t, base);
+        LOG("  match: %s\n", equal() ? "yes" : "NO");
+
+        #undef MEASURE
+    }
+};
+
+// level load benchmark: parse, tile conversion, atlas packing and CPU geometry build
+int getPeakRSS() { // KB
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return 0;
+    char line[128];
+    int value = 0;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmHWM: %d kB", &value) == 1)
+            break;
+    fclose(f);
+    return value;
+}
+
+void resetPeakRSS() {
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (!f) return;
+    fputs("5", f);
+    fclose(f);
+}
+
+double getPhaseTime(const char *name) {
+    double time = 0.0;
+    for (int i = 0; i < LoadProfile::phasesCount; i++) {
+        LoadProfile::Phase &p = LoadProfile::phases[i];
+        if (p.level == LoadProfile::levelsCount - 1 && !strcmp(p.name, name))
+            time += p.time;
+    }
+    return time;
+}
+
+// frustum culling: per-corner tests & plane transform by inverse matrix (pre-SIMD code) vs Frustum
+#define BENCH_BOXES 4096
+
+struct FrustumBench {
+    Frustum frustum;
+    vec4    planes[5 * 2];
+    mat4    matrices[BENCH_BOXES];
+    Box     boxes[BENCH_BOXES];
+    bool    ref[BENCH_BOXES], out[BENCH_BOXES];
+
+    static float rnd(float a, float b) {
+        return a + (b - a) * float(rand()) / float(RAND_MAX);
+    }
+
+    FrustumBench() {
+        srand(0);
+        mat4 mView = mat4(vec3(0.0f), vec3(0.0f, 0.0f, 1024.0f), vec3(0.0f, -1.0f, 0.0f)).inverse();
+        mat4 mProj = mat4(75.0f, 16.0f / 9.0f, 32.0f, 45.0f * 1024.0f);
+        frustum.calcPlanes(mProj * mView);
+        memcpy(planes, frustum.planes, sizeof(vec4) * 5);
+
+        for (int i = 0; i < BENCH_BOXES; i++) {
+            vec3 c(rnd(-16384.0f, 16384.0f), rnd(-4096.0f, 4096.0f), rnd(-16384.0f, 16384.0f));
+            vec3 e(rnd(64.0f, 1024.0f), rnd(64.0f, 1024.0f), rnd(64.0f, 1024.0f));
+            boxes[i] = Box(-e, e);
+            matrices[i].identity();
+            matrices[i].rotateY(rnd(0.0f, PI * 2.0f));
+            matrices[i].rotateX(rnd(-0.5f, 0.5f));
+            matrices[i].setPos(c);
+        }
+    }
+
+    bool refIsVisible(int start, const vec3 &min, const vec3 &max) {
+        for (int i = start; i < start + 5; i++) {
+            const vec3 &n = planes[i].xyz();
+            const float d = -planes[i].w;
+            bool outside = true;
+            for (int j = 0; j < 8 && outside; j++)
+                outside = n.dot(Box(min, max)[j]) < d;
+            if (outside)
+                return false;
+        }
+        return true;
+    }
+
+    bool refIsVisible(const mat4 &matrix, const vec3 &min, const vec3 &max) {
+        mat4 m = matrix.inverse();
+        for (int i = 0; i < 5; i++) {
+            vec4 &p = planes[i];
+            vec4 o = m * vec4(p.xyz() * (-p.w), 1.0f);
+            vec4 n = m * vec4(p.xyz(), 0.0f);
+            planes[5 + i] = vec4(n.xyz(), -n.xyz().dot(o.xyz()));
+        }
+        return refIsVisible(5, min, max);
+    }
+
+    int mismatches() {
+        int count = 0;
+        for (int i = 0; i < BENCH_BOXES; i++)
+            count += ref[i] != out[i];
+        return count;
+    }
+
+    void run() {
+        double t, tRef;
+        int visible = 0;
+
+        #define MEASURE(expr) t = getPreciseTime(); for (int r = 0; r < BENCH_REPEAT; r++) { expr; } t = getPreciseTime() - t;
+        #define PER_BOX(t) (t * 1000000.0 / (BENCH_BOXES * BENCH_REPEAT))
+
+        LOG("frustum: %d boxes x %d\n", BENCH_BOXES, BENCH_REPEAT);
+
+        MEASURE(for (int i = 0; i < BENCH_BOXES; i++) ref[i] = refIsVisible(0, boxes[i].min + matrices[i].getPos(), boxes[i].max + matrices[i].getPos()));
+        tRef = t;
+        MEASURE(for (int i = 0; i < BENCH_BOXES; i++) out[i] = frustum.isVisible(boxes[i].min + matrices[i].getPos(), boxes[i].max + matrices[i].getPos()));
+        LOG("  AABB: corners %.1f ns/box, batched %.1f ns/box (x%.2f), mismatches: %d\n", PER_BOX(tRef), PER_BOX(t), tRef / max(t, 1e-6), mismatches());
+
+        MEASURE(for (int i = 0; i < BENCH_BOXES; i++) ref[i] = refIsVisible(matrices[i], boxes[i].min, boxes[i].max));
+        tRef = t;
+        MEASURE(frustum.isVisible(matrices, boxes, out, BENCH_BOXES));
+        for (int i = 0; i < BENCH_BOXES; i++)
+            visible += out[i];
+        LOG("  OBB:  inverse %.1f ns/box, batched %.1f ns/box (x%.2f), mismatches: %d, visible %d%%\n", PER_BOX(tRef), PER_BOX(t), tRef / max(t, 1e-6), mismatches(), visible * 100 / BENCH_BOXES);
+
+        #undef PER_BOX
+        #undef MEASURE
+    }
+};
+
+// portal visibility: recursive walk over Room::Portal (pre-table code) vs Level::getVisibleRooms
+#define BENCH_VIEW_DIRS 8
+
+bool benchPortals = false;
+
+bool refCheckPortal(const TR::Room &room, const TR::Room::Portal &portal, const vec4 &viewPort, vec4 &clipPort) {
+    vec3 n = portal.normal;
+    vec3 v = Core::viewPos - (room.getOffset() + portal.vertices[0]);
+
+    if (n.dot(v) <= 0.0f)
+        return false;
+
+    int  zClip = 0;
+    vec4 p[4];
+
+    clipPort = vec4(INF, INF, -INF, -INF);
+
+    for (int i = 0; i < 4; i++) {
+        p[i] = Core::mViewProj * vec4(vec3(portal.vertices[i]) + room.getOffset(), 1.0f);
+
+        if (p[i].w > 0.0f) {
+            p[i].xyz() *= (1.0f / p[i].w);
+
+            clipPort.x = min(clipPort.x, p[i].x);
+            clipPort.y = min(clipPort.y, p[i].y);
+            clipPort.z = max(clipPort.z, p[i].x);
+            clipPort.w = max(clipPort.w, p[i].y);
+        } else
+            zClip++;
+    }
+
+    if (zClip == 4)
+        return false;
+
+    if (zClip > 0) {
+        for (int i = 0; i < 4; i++) {
+            vec4 &a = p[i];
+            vec4 &b = p[(i + 1) % 4];
+
+            if ((a.w > 0.0f) ^ (b.w > 0.0f)) {
+                if (a.x < 0.0f && b.x < 0.0f)
+                    clipPort.x = -1.0f;
+                else if (a.x > 0.0f && b.x > 0.0f)
+                    clipPort.z = 1.0f;
+                else {
+                    clipPort.x = -1.0f;
+                    clipPort.z =  1.0f;
+                }
+
+                if (a.y < 0.0f && b.y < 0.0f)
+                    clipPort.y = -1.0f;
+                else if (a.y > 0.0f && b.y > 0.0f)
+                    clipPort.w = 1.0f;
+                else {
+                    clipPort.y = -1.0f;
+                    clipPort.w =  1.0f;
+                }
+            }
+        }
+    }
+
+    if (clipPort.x > viewPort.z || clipPort.y > viewPort.w || clipPort.z < viewPort.x || clipPort.w < viewPort.y)
+        return false;
+
+    clipPort.x = max(clipPort.x, viewPort.x);
+    clipPort.y = max(clipPort.y, viewPort.y);
+    clipPort.z = min(clipPort.z, viewPort.z);
+    clipPort.w = min(clipPort.w, viewPort.w);
+
+    return true;
+}
+
+void refVisibleRooms(TR::Level &level, int *roomsList, int &roomsCount, int from, int to, const vec4 &viewPort, int count = 0) {
+    if (count > MAX_PORTAL_DEPTH)
+        return;
+
+    if (level.rooms[to].alternateRoom > -1 && level.state.flags.flipped)
+        to = level.rooms[to].alternateRoom;
+
+    TR::Room &room = level.rooms[to];
+
+    if (!room.flags.visible) {
+        room.flags.visible = true;
+        roomsList[roomsCount++] = to;
+    }
+
+    vec4 clipPort;
+    for (int i = 0; i < room.portalsCount; i++) {
+        TR::Room::Portal &p = room.portals[i];
+        if (from != p.roomIndex && refCheckPortal(room, p, viewPort, clipPort))
+            refVisibleRooms(level, roomsList, roomsCount, to, p.roomIndex, clipPort, count + 1);
+    }
+}
+
+void setBenchView(TR::Level &level, int roomIndex, int dir) {
+    TR::Room &room = level.rooms[roomIndex];
+    vec3 eye    = room.getOffset() + vec3(float(room.xSectors * 512), float(room.info.yBottom + room.info.yTop) * 0.5f, float(room.zSectors * 512));
+    vec3 target = eye + vec3(0.0f, 0.0f, 1024.0f).rotateY(float(dir) * PI * 2.0f / BENCH_VIEW_DIRS);
+
+    Core::mViewInv  = mat4(eye, target, vec3(0, -1, 0));
+    Core::mView     = Core::mViewInv.inverse();
+    Core::mProj     = mat4(75.0f, 16.0f / 9.0f, 32.0f, 45.0f * 1024.0f);
+    Core::mViewProj = Core::mProj * Core::mView;
+    Core::viewPos   = eye;
+}
+
+void benchPortalsLevel(Level *level) {
+    TR::Level &data = level->level;
+
+    int list[256], refList[256], count, refCount, extra = 0, lost = 0, culled = 0, visible = 0, statics = 0, staticsClipped = 0;
+    double time, refTime = 0.0, newTime = 0.0;
+
+    for (int r = 0; r < BENCH_REPEAT; r++)
+        for (int i = 0; i < data.roomsCount; i++)
+            for (int dir = 0; dir < BENCH_VIEW_DIRS; dir++) {
+                setBenchView(data, i, dir);
+                level->viewFrustum.calcPlanes(Core::mViewProj);
+
+                const mat4 &m = Core::mViewProj;
+                vec4 farPlane(m.e30 - m.e20, m.e31 - m.e21, m.e32 - m.e22, m.e33 - m.e23);
+                int  flip  = data.state.flags.flipped ? 1 : 0;
+                int  start = data.getRoomIndex(i, flip);
+
+                for (int j = 0; j < data.roomsCount; j++)
+                    data.rooms[j].flags.visible = false;
+                refCount = 0;
+                time = getPreciseTime();
+                refVisibleRooms(data, refList, refCount, TR::NO_ROOM, i, vec4(-1.0f, -1.0f, 1.0f, 1.0f));
+                refTime += getPreciseTime() - time;
+
+                for (int j = 0; j < data.roomsCount; j++)
+                    data.rooms[j].flags.visible = false;
+                count = 0;
+                time = getPreciseTime();
+                level->getVisibleRooms(list, count, i, vec4(-1.0f, -1.0f, 1.0f, 1.0f), false);
+                newTime += getPreciseTime() - time;
+
+            #ifndef SPLIT_BY_TILE
+                for (int j = 0; j < count; j++) {
+                    level->clipStatics(list[j]);
+                    statics        += data.rooms[list[j]].meshesCount;
+                    staticsClipped += level->mesh->rooms[list[j]].staticsCulled;
+                }
+            #endif
+
+            // PVS & far plane rejection may only remove rooms from the recursive walk result
+                for (int j = 0; j < data.roomsCount; j++)
+                    data.rooms[j].flags.visible = false;
+                for (int j = 0; j < refCount; j++)
+                    data.rooms[refList[j]].flags.visible = true;
+                for (int j = 0; j < count; j++)
+                    extra += !data.rooms[list[j]].flags.visible;
+
+            // and every room it drops must be rejected by the PVS or the far plane itself
+                for (int j = 0; j < data.roomsCount; j++)
+                    data.rooms[j].flags.visible = false;
+                for (int j = 0; j < count; j++)
+                    data.rooms[list[j]].flags.visible = true;
+                for (int j = 0; j < refCount; j++) {
+                    TR::Room &room = data.rooms[refList[j]];
+                    if (!room.flags.visible && data.isPotentiallyVisible(flip, start, refList[j]) && !level->isRoomBeyond(room, farPlane))
+                        lost++;
+                }
+
+                culled  += refCount - count;
+                visible += count;
+            }
+
+    int pvs = 0;
+    for (int i = 0; i < data.roomsCount; i++)
+        for (int j = 0; j < data.roomsCount; j++)
+            pvs += data.isPotentiallyVisible(data.state.flags.flipped, i, j);
+
+    int views = data.roomsCount * BENCH_VIEW_DIRS * BENCH_REPEAT;
+    LOG("  portals: %d in %d rooms (max %d per room), %d views, PVS %.1f rooms/room\n", data.portalInfosCount, data.roomsCount, data.portalsMax, views, float(pvs) / max(int(data.roomsCount), 1));
+    LOG("  portals: visible %.1f rooms/view, culled by PVS & far plane %.1f rooms/view, extra rooms: %d, lost rooms: %d\n", float(visible) / max(views, 1), float(culled) / max(views, 1), extra, lost);
+    LOG("  match: %s\n", (!extra && !lost) ? "yes" : "NO");
+    LOG("  portals: static meshes %.1f/view, clipped by room portal windows %.1f/view\n", float(statics) / max(views, 1), float(staticsClipped) / max(views, 1));
+    LOG("  portals: recursive %.3f us/view, table %.3f us/view (x%.2f)\n", refTime * 1000.0 / views, newTime * 1000.0 / views, refTime / max(newTime, 1e-6));
+}
+
+// animation commands due on the passed frames: command stream scan (pre-table code) vs frame event tables
+int refAnimEvents(TR::Level &data, Animation &anim) {
+    TR::Animation *a = anim;
+    int16 *ptr = &data.commands[a->animCommand];
+    int due = 0;
+    for (int i = 0; i < a->acCount; i++) {
+        switch (*ptr++) {
+            case TR::ANIM_CMD_OFFSET : ptr += 3; break;
+            case TR::ANIM_CMD_JUMP   : ptr += 2; break;
+            case TR::ANIM_CMD_SOUND  :
+            case TR::ANIM_CMD_EFFECT :
+                due += anim.isFrameActive(ptr[0] - a->frameStart);
+                ptr += 2;
+                break;
+        }
+    }
+    return due;
+}
+
+int newAnimEvents(TR::Level &data, Animation &anim) {
+    const TR::AnimCommands &ac = data.animCommands[(TR::Animation*)anim - data.anims];
+    int from = max(anim.framePrev + 1, 0);
+    int to   = min(anim.frameIndex, ac.frames - 1);
+    if (ac.events == -1 || from > to)
+        return 0;
+    const int32 *first = data.animEventFrames + ac.events;
+    return first[to + 1] - first[from];
+}
+
+// controllers as Level::init creates them, the GPU resources, caches and sounds of the renderer are skipped
+bool benchInitControllers(Level *level) {
+    TR::Level &data = level->level;
+
+    level->params = (Level::Params*)&Core::params;
+    level->params->time = 0.0f;
+
+    for (int i = 0; i < data.entitiesBaseCount; i++) {
+        TR::Entity &e = data.entities[i];
+        e.controller = level->initController(i);
+        if (e.type == TR::Entity::LARA || ((data.version & TR::VER_TR1) && e.type == TR::Entity::CUT_1))
+            level->players[0] = (Lara*)e.controller;
+    }
+    level->updateRoomEntities();
+
+    level->effect        = TR::Effect::NONE;
+    level->sndSoundtrack = level->sndUnderwater = level->sndCurrent = NULL;
+    level->playNextTrack = false;
+
+    if (data.isTitle() || !level->players[0])
+        return false;
+
+    level->player    = level->players[0];
+    level->camera    = level->player->camera;
+    level->zoneCache = new ZoneCache(level);
+
+// wake up the enemies, triggers do it in game
+    for (int i = 0; i < data.entitiesBaseCount; i++)
+        if (data.entities[i].isEnemy() && data.entities[i].controller)
+            ((Controller*)data.entities[i].controller)->activate();
+
+    return true;
+}
+
+// pose evaluation: per frame angle decoding (pre-table code) vs decoded frame tables
+#define BENCH_ANIM_STEPS 256
+
+bool benchAnim = false;
+
+void benchAnimLevel(Level *level) {
+    TR::Level &data = level->level;
+
+    Basis joints[64], pose[64];
+    quat  ref[64], rot[64];
+    mat4  matrix;
+    matrix.identity();
+
+    int poses = 0, mismatches = 0;
+    float maxError = 0.0f;
+    double time, refTime = 0.0, newTime = 0.0, poseTime = 0.0, batchTime = 0.0;
+
+    Core::deltaTime = 1.0f / 30.0f;
+
+    for (int i = 0; i < data.modelsCount; i++) {
+        const TR::Model &model = data.models[i];
+        if (model.animation >= data.animsCount || !model.mCount || model.mCount > COUNT(joints)) continue;
+
+        Animation anim(&data, &model);
+        for (int step = 0; step < BENCH_ANIM_STEPS; step++) {
+            time = getPreciseTime();
+            for (int r = 0; r < BENCH_REPEAT; r++)
+                for (int j = 0; j < model.mCount; j++)
+                    ref[j] = lerpAngle(anim.frameA->getAngle(data.version, j), anim.frameB->getAngle(data.version, j), anim.delta);
+            refTime += getPreciseTime() - time;
+
+            time = getPreciseTime();
+            for (int r = 0; r < BENCH_REPEAT; r++)
+                for (int j = 0; j < model.mCount; j++)
+                    rot[j] = anim.getJointRot(j);
+            newTime += getPreciseTime() - time;
+
+            time = getPreciseTime();
+            for (int r = 0; r < BENCH_REPEAT; r++)
+                anim.getJoints(matrix, -1, true, joints);
+            poseTime += getPreciseTime() - time;
+
+            time = getPreciseTime();
+            for (int r = 0; r < BENCH_REPEAT; r++)
+                anim.getPose(matrix, pose);
+            batchTime += getPreciseTime() - time;
+
+            for (int j = 0; j < model.mCount; j++) {
+                maxError = max(maxError, (joints[j].pos - pose[j].pos).length());
+                maxError = max(maxError, 1.0f - fabsf(joints[j].rot.dot(pose[j].rot)));
+            }
+
+            for (int j = 0; j < model.mCount; j++)
+                if (fabsf(ref[j].x - rot[j].x) > EPS || fabsf(ref[j].y - rot[j].y) > EPS || fabsf(ref[j].z - rot[j].z) > EPS || fabsf(ref[j].w - rot[j].w) > EPS)
+                    mismatches++;
+            poses++;
+
+            anim.update();
+            if (anim.isEnded)
+                anim.playNext();
+        }
+    }
+
+    int decoded = 0;
+    for (int i = 0; i < data.animsCount; i++)
+        decoded += data.animFrames[i].count;
+
+    poses = max(poses, 1) * BENCH_REPEAT;
+    LOG("  anim: %d poses, joint rotations: decode %.3f us/pose, table %.3f us/pose (x%.2f), mismatches: %d\n",
+        poses / BENCH_REPEAT, refTime * 1000.0 / poses, newTime * 1000.0 / poses, refTime / max(newTime, 1e-6), mismatches);
+    LOG("  anim: getJoints %.3f us/pose, getPose %.3f us/pose (x%.2f), max error %f\n",
+        poseTime * 1000.0 / poses, batchTime * 1000.0 / poses, poseTime / max(batchTime, 1e-6), maxError);
+
+// all animated entities of the level posed per entity and as Level::updatePoses does for a view,
+// Controller::updateJoints is a plain loop over getPose, so the difference is getPose against getJoints
+    if (!benchInitControllers(level)) {
+        LOG("  anim: no player in the level, entities are not benchmarked\n");
+    }
+
+    Controller **list = new Controller*[data.entitiesCount];
+    int count = 0;
+    for (int i = 0; i < data.entitiesCount; i++) {
+        Controller *c = (Controller*)data.entities[i].controller;
+        if (c && c->getModel() && c->joints)
+            list[count++] = c;
+    }
+
+    if (count) {
+        time = getPreciseTime();
+        for (int r = 0; r < BENCH_REPEAT; r++)
+            for (int i = 0; i < count; i++)
+                list[i]->animation.getJoints(list[i]->getMatrix(), -1, true, list[i]->joints);
+        refTime = getPreciseTime() - time;
+
+        time = getPreciseTime();
+        for (int r = 0; r < BENCH_REPEAT; r++)
+            Controller::updateJoints(list, count);
+        newTime = getPreciseTime() - time;
+
+        LOG("  anim: %d animated entities, getJoints %.3f us/frame, getPose (updateJoints) %.3f us/frame (x%.2f)\n",
+            count, refTime * 1000.0 / BENCH_REPEAT, newTime * 1000.0 / BENCH_REPEAT, refTime / max(newTime, 1e-6));
+
+    // parallel pose phase of Level::updateControllers against the serial path
+        Basis *serial = new Basis[count * MAX_POSE_JOINTS];
+        for (int i = 0; i < count; i++)
+            memcpy(serial + i * MAX_POSE_JOINTS, list[i]->joints, min(int(list[i]->getModel()->mCount), MAX_POSE_JOINTS) * sizeof(Basis));
+
+        time = getPreciseTime();
+        for (int r = 0; r < BENCH_REPEAT; r++)
+            parallelFor(count, Controller::updateJointsJob, list);
+        time = getPreciseTime() - time;
+
+        int diverged = 0;
+        for (int i = 0; i < count; i++)
+            if (memcmp(serial + i * MAX_POSE_JOINTS, list[i]->joints, min(int(list[i]->getModel()->mCount), MAX_POSE_JOINTS) * sizeof(Basis)))
+                diverged++;
+        delete[] serial;
+
+        LOG("  anim: parallel batch %.3f us/frame on %d cores (x%.2f), diverged from serial: %d\n",
+            time * 1000.0 / BENCH_REPEAT, osGetCPUCount(), newTime / max(time, 1e-6), diverged);
+
+    // fixed rate ticks with interpolated frames against a pose per displayed frame, CPU time per second of the poses
+        double storeTime = getPreciseTime();
+        for (int r = 0; r < BENCH_REPEAT; r++)
+            for (int i = 0; i < count; i++)
+                list[i]->storeJoints(r);
+        storeTime = (getPreciseTime() - storeTime) / BENCH_REPEAT;
+
+        double lerpTime = getPreciseTime();
+        for (int r = 0; r < BENCH_REPEAT; r++)
+            for (int i = 0; i < count; i++)
+                list[i]->interpolateJoints(BENCH_REPEAT - 1, (r + 0.5f) / BENCH_REPEAT);
+        lerpTime = (getPreciseTime() - lerpTime) / BENCH_REPEAT;
+
+        double tickTime = newTime / BENCH_REPEAT;
+        const int rates[] = { 60, 144, 240 };
+        for (int i = 0; i < int(COUNT(rates)); i++) {
+            LOG("  anim: %3d Hz, pose per frame %.3f ms/s, %d Hz ticks + interpolation %.3f ms/s\n",
+                rates[i], tickTime * rates[i], TICK_RATE, (tickTime + storeTime) * TICK_RATE + lerpTime * rates[i]);
+        }
+
+    // ticks of all animated entities, the tables must give the events of the stream scan on every tick
+        int refDue = 0, newDue = 0, mismatches = 0;
+        int *due = new int[count];
+        refTime = newTime = 0.0;
+        for (int step = 0; step < BENCH_ANIM_STEPS; step++) {
+            time = getPreciseTime();
+            for (int i = 0; i < count; i++)
+                due[i] = refAnimEvents(data, list[i]->animation);
+            refTime += getPreciseTime() - time;
+
+            time = getPreciseTime();
+            for (int i = 0; i < count; i++)
+                newDue += newAnimEvents(data, list[i]->animation);
+            newTime += getPreciseTime() - time;
+
+            for (int i = 0; i < count; i++) {
+                refDue     += due[i];
+                mismatches += due[i] != newAnimEvents(data, list[i]->animation);
+
+                Animation &anim = list[i]->animation;
+                anim.framePrev = anim.frameIndex;
+                anim.update();
+                if (anim.isEnded)
+                    anim.playNext();
+            }
+        }
+        delete[] due;
+
+        LOG("  anim: commands of %d entities, stream scan %.3f us/tick, event tables %.3f us/tick (x%.2f), due events %d/%d\n",
+            count, refTime * 1000.0 / BENCH_ANIM_STEPS, newTime * 1000.0 / BENCH_ANIM_STEPS, refTime / max(newTime, 1e-6), newDue, refDue);
+        LOG("  match: %s (%d entity ticks differ)\n", (mismatches == 0 && newDue == refDue) ? "yes" : "NO", mismatches);
+    }
+    delete[] list;
+
+    LOG("  anim: %d frames decoded, tables %d KB\n", decoded, int(sizeof(float) * data.framesRotSize + sizeof(TR::AnimFrames) * data.animsCount) / 1024);
+}
+
+// full ticks from the level start, the read phase with parallel poses against the serial reference tick (see Level::updateControllers)
+#define BENCH_TICKS (TICK_RATE * 10)
+
+struct BenchEntity {
+    bool  alive;
+    vec3  pos, angle;
+    int   roomIndex, anim, frame, state, joints;
+    Basis pose[MAX_POSE_JOINTS];
+
+    bool operator == (const BenchEntity &e) const {
+        if (alive != e.alive) return false;
+        if (!alive) return true;
+        return pos == e.pos && angle == e.angle && roomIndex == e.roomIndex && anim == e.anim && frame == e.frame && state == e.state &&
+               joints == e.joints && !memcmp(pose, e.pose, joints * sizeof(Basis));
+    }
+};
+
+BenchEntity* benchTicksRun(const char *fileName, bool parallel, int &count, double &time) {
+    srand(0); // spawned sprites and AI decisions use rand
+
+    Stream *stream = new Stream(fileName);
+    Level  *level  = new Level(*stream);
+    delete stream;
+
+    TR::Level &data = level->level;
+    BenchEntity *states = NULL;
+
+    if (benchInitControllers(level)) {
+        level->parallelUpdate = parallel;
+        Core::deltaTime = 1.0f / TICK_RATE;
+
+        time = getPreciseTime();
+        for (int i = 0; i < BENCH_TICKS; i++)
+            level->updateControllers();
+        time = getPreciseTime() - time;
+
+        count  = data.entitiesCount;
+        states = new BenchEntity[count];
+        for (int i = 0; i < count; i++) {
+            BenchEntity &s = states[i];
+            Controller  *c = (Controller*)data.entities[i].controller;
+            s.alive = c != NULL;
+            if (!c) continue;
+            s.pos       = c->pos;
+            s.angle     = c->angle;
+            s.roomIndex = c->roomIndex;
+            s.anim      = c->animation.index;
+            s.frame     = c->animation.frameIndex;
+            s.state     = c->state;
+            s.joints    = (c->getModel() && c->joints) ? min(int(c->getModel()->mCount), MAX_POSE_JOINTS) : 0;
+            if (s.joints)
+                c->animation.getPose(c->getMatrix(), s.pose);
+        }
+    }
+
+    delete level;
+    return states;
+}
+
+void benchTicks(const char *fileName) {
+    int    count, refCount;
+    double time, refTime;
+
+    BenchEntity *states = benchTicksRun(fileName, true, count, time);
+    if (!states) return;
+    BenchEntity *ref = benchTicksRun(fileName, false, refCount, refTime);
+    if (!ref) {
+        delete[] states;
+        return;
+    }
+
+    int diverged = 0, first = -1;
+    for (int i = 0; i < min(count, refCount); i++)
+        if (!(states[i] == ref[i])) {
+            if (first == -1) first = i;
+            diverged++;
+        }
+    diverged += abs(count - refCount);
+
+    LOG("  ticks: %d ticks on %d cores, read phase + parallel poses %.3f ms/tick, serial reference %.3f ms/tick (x%.2f)\n",
+        BENCH_TICKS, osGetCPUCount(), time / BENCH_TICKS, refTime / BENCH_TICKS, refTime / max(time, 1e-6));
+    LOG("  ticks: entities diverged from the serial reference (pos, room, animation, pose): %d of %d (first %d)\n", diverged, max(count, refCount), first);
+
+    delete[] states;
+    delete[] ref;
+}
+
+void benchLevel(const char *fileName) {
+    if (!Stream::exists(fileName)) {
+        LOG("! can't open \"%s\"\n", fileName);
+        return;
+    }
+
+    resetPeakRSS();
+    LoadProfile::begin(fileName);
+
+    double time = getPreciseTime();
+    Stream *stream = new Stream(fileName);
+    Level  *level  = new Level(*stream);
+    delete stream;
+    time = getPreciseTime() - time;
+
+    MeshBuilder::Buffer &buf = level->mesh->buffer;
+
+    LOG("%-16s total %8.2f ms | parse %7.2f textures %7.2f mesh %7.2f | peak RSS %6d KB | atlas %dx%d (%d KB) indices %d (%d KB) vertices %d (%d KB)\n",
+        LoadProfile::levels[LoadProfile::levelsCount - 1], time,
+        getPhaseTime("parse"), getPhaseTime("textures"), getPhaseTime("mesh"),
+        getPeakRSS(),
+        level->atlasWidth, level->atlasHeight, level->atlasWidth * level->atlasHeight * 4 / 1024,
+        buf.iCount, int(buf.iCount * sizeof(Index) / 1024),
+        buf.vCount, int(buf.vCount * sizeof(Vertex) / 1024));
+    LoadProfile::print();
+
+    TR::Level &data = level->level;
+    LOG("  arena: %d allocs in %d KB (%d KB used)\n", data.arena.allocs, data.arena.capacity / 1024, data.arena.getUsed() / 1024);
+
+    if (benchPortals)
+        benchPortalsLevel(level);
+
+    if (benchAnim)
+        benchAnimLevel(level);
+
+    time = getPreciseTime();
+    delete level;
+    LOG("  unload: %.3f ms\n", getPreciseTime() - time);
+
+    if (benchAnim)
+        benchTicks(fileName);
+}
+
+int main(int argc, char **argv) {
+    Stream::contentDir[0] = Stream::cacheDir[0] = 0;
+
+    if (argc < 2) {
+        LOG("usage: %s [-tiles] [-frustum] [-portals] [-anim] [-water 0..2] [-cache dir/] [-o report.json] level files...\n", argv[0]);
+        return 1;
+    }
+
+    Core::settings.detail.water = Core::Settings::HIGH;
+
+    const char *report = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-tiles")) {
+            TileBench *bench = new TileBench();
+            bench->run();
+            delete bench;
+        } else if (!strcmp(argv[i], "-frustum")) {
+            FrustumBench *bench = new FrustumBench();
+            bench->run();
+            delete bench;
+        } else if (!strcmp(argv[i], "-portals")) {
+            benchPortals = true;
+        } else if (!strcmp(argv[i], "-anim")) {
+            benchAnim = true;
+        } else if (!strcmp(argv[i], "-water") && i + 1 < argc) {
+            Core::settings.detail.water = clamp(atoi(argv[++i]), 0, 2);
+        } else if (!strcmp(argv[i], "-cache") && i + 1 < argc) {
+            strcpy(Stream::cacheDir, argv[++i]);
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            report = argv[++i];
+        } else
+            benchLevel(argv[i]);
+    }
+
+    if (report)
+        LoadProfile::save(report);
+
+    return 0;
+}
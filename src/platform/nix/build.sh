@@ -1,3 +1,4 @@
 set -e
 clang++ -std=c++11 -Os -s -fno-exceptions -fno-rtti -ffunction-sections -fdata-sections -Wl,--gc-sections -DNDEBUG -D_POSIX_THREADS -D_POSIX_READER_WRITER_LOCKS main.cpp ../../libs/stb_vorbis/stb_vorbis.c ../../libs/minimp3/minimp3.cpp ../../libs/tinf/tinflate.c -I../../ -o../../../bin/OpenLara -lX11 -lGL -lm -lpthread -lpulse-simple -lpulse
 strip ../../../bin/OpenLara --strip-all --remove-section=.comment --remove-section=.note
+clang++ -std=c++11 -O2 -fno-exceptions -fno-rtti -DNDEBUG -DPROFILE_LOAD -D_POSIX_THREADS -D_POSIX_READER_WRITER_LOCKS bench.cpp ../../libs/stb_vorbis/stb_vorbis.c ../../libs/minimp3/minimp3.cpp ../../libs/tinf/tinflate.c -I../../ -o../../../bin/OpenLaraBench -lm -lpthread
@@ -83,6 +83,27 @@ void osRWUnlockWrite(void *obj) {
     osMutexUnlock(obj);
 }
 
+// single core, run in place (level loading and jobs become synchronous)
+void* osThreadCreate(ThreadProc *proc, void *arg) {
+    proc(arg);
+    return NULL;
+}
+
+void osThreadJoin(void *obj) {}
+
+int osGetCPUCount() {
+    return 1;
+}
+
+// no threads to wait for
+void* osEventInit() {
+    return NULL;
+}
+
+void osEventFree(void *obj) {}
+void osEventSignal(void *obj) {}
+void osEventWait(void *obj) {}
+
 
 // timing
 int osStartTime = 0;
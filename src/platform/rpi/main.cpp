@@ -62,6 +62,59 @@ void osRWUnlockWrite(void *obj) {
     pthread_rwlock_unlock((pthread_rwlock_t*)obj);
 }
 
+void* osThreadCreate(ThreadProc *proc, void *arg) {
+    pthread_t *thread = new pthread_t();
+    pthread_create(thread, NULL, proc, arg);
+    return thread;
+}
+
+void osThreadJoin(void *obj) {
+    pthread_join(*(pthread_t*)obj, NULL);
+    delete (pthread_t*)obj;
+}
+
+int osGetCPUCount() {
+    return max(int(sysconf(_SC_NPROCESSORS_ONLN)), 1);
+}
+
+struct OSEvent {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            signaled;
+};
+
+void* osEventInit() {
+    OSEvent *e = new OSEvent();
+    pthread_mutex_init(&e->mutex, NULL);
+    pthread_cond_init(&e->cond, NULL);
+    e->signaled = false;
+    return e;
+}
+
+void osEventFree(void *obj) {
+    OSEvent *e = (OSEvent*)obj;
+    pthread_cond_destroy(&e->cond);
+    pthread_mutex_destroy(&e->mutex);
+    delete e;
+}
+
+void osEventSignal(void *obj) {
+    OSEvent *e = (OSEvent*)obj;
+    pthread_mutex_lock(&e->mutex);
+    e->signaled = true;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->mutex);
+}
+
+void osEventWait(void *obj) {
+    OSEvent *e = (OSEvent*)obj;
+    pthread_mutex_lock(&e->mutex);
+    while (!e->signaled)
+        pthread_cond_wait(&e->cond, &e->mutex);
+    e->signaled = false;
+    pthread_mutex_unlock(&e->mutex);
+}
+
 
 // timing
 unsigned int startTime;
@@ -58,6 +58,27 @@ void osRWUnlockWrite(void *obj) {
     pthread_rwlock_unlock((pthread_rwlock_t*)obj);
 }
 
+// no pthreads in the default build, run in place
+void* osThreadCreate(ThreadProc *proc, void *arg) {
+    proc(arg);
+    return NULL;
+}
+
+void osThreadJoin(void *obj) {}
+
+int osGetCPUCount() {
+    return 1;
+}
+
+// no threads to wait for
+void* osEventInit() {
+    return NULL;
+}
+
+void osEventFree(void *obj) {}
+void osEventSignal(void *obj) {}
+void osEventWait(void *obj) {}
+
 
 // timing
 int osGetTime() {
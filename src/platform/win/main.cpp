@@ -96,6 +96,52 @@ void osRWUnlockWrite(void *obj) {
     ReleaseSRWLockExclusive((SRWLOCK*)obj);
 }
 
+struct ThreadData {
+    ThreadProc *proc;
+    void       *arg;
+};
+
+DWORD WINAPI osThreadProc(LPVOID param) {
+    ThreadData data = *(ThreadData*)param;
+    delete (ThreadData*)param;
+    data.proc(data.arg);
+    return 0;
+}
+
+void* osThreadCreate(ThreadProc *proc, void *arg) {
+    ThreadData *data = new ThreadData();
+    data->proc = proc;
+    data->arg  = arg;
+    return CreateThread(NULL, 0, osThreadProc, data, 0, NULL);
+}
+
+void osThreadJoin(void *obj) {
+    WaitForSingleObject((HANDLE)obj, INFINITE);
+    CloseHandle((HANDLE)obj);
+}
+
+int osGetCPUCount() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return max(int(info.dwNumberOfProcessors), 1);
+}
+
+void* osEventInit() {
+    return CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+void osEventFree(void *obj) {
+    CloseHandle((HANDLE)obj);
+}
+
+void osEventSignal(void *obj) {
+    SetEvent((HANDLE)obj);
+}
+
+void osEventWait(void *obj) {
+    WaitForSingleObject((HANDLE)obj, INFINITE);
+}
+
 
 // timing
 int osStartTime = 0;
@@ -187,6 +187,7 @@ struct Shader {
     bool bind() {
         if (Core::active.shader != this) {
             Core::active.shader = this;
+            Core::stats.shaders++;
             glUseProgram(ID);
             return true;
         }
@@ -27,6 +27,12 @@
 #define SND_FADEOFF_DIST    (1024.0f * 8.0f)
 #define SND_MAX_VOLUME      20
 
+#ifdef _PSP
+    #define SND_CACHE_SIZE  (2 * 1024 * 1024)
+#else
+    #define SND_CACHE_SIZE  (16 * 1024 * 1024)
+#endif
+
 namespace Sound {
 
     struct Frame {
@@ -143,7 +149,7 @@ namespace Sound {
         Stream  *stream;
         int     channels, offset;
 
-        Decoder(Stream *stream, int channels) : stream(stream), channels(channels), offset(stream->pos) {}
+        Decoder(Stream *stream, int channels) : stream(stream), channels(channels), offset(stream ? stream->pos : 0) {}
         virtual ~Decoder() { delete stream; }
         virtual int decode(Frame *frames, int count) { return 0; }
         virtual void replay() { stream->seek(offset - stream->pos); }
@@ -466,6 +472,210 @@ namespace Sound {
 
     bool flipped;
 
+    Decoder* openDecoder(Stream *stream) {
+        Decoder *decoder = NULL;
+
+        uint32 fourcc; 
+        stream->read(fourcc);
+        if (fourcc == FOURCC("RIFF")) { // wav
+
+            struct {
+                uint16  format;
+                uint16  channels;
+                uint32  samplesPerSec;
+                uint32  bytesPerSec;
+                uint16  block;
+                uint16  sampleBits;
+            } waveFmt;
+
+            stream->seek(8);
+            while (stream->pos < stream->size) {
+                uint32 type, size;
+                stream->read(type);
+                stream->read(size);
+                if (type == FOURCC("fmt ")) {
+                    stream->raw(&waveFmt, sizeof(waveFmt));
+                    stream->seek(size - sizeof(waveFmt));
+                } else if (type == FOURCC("data")) {
+                    if (waveFmt.format == 1) decoder = new PCM(stream, waveFmt.channels, waveFmt.samplesPerSec, size, waveFmt.sampleBits);
+                    #ifdef DECODE_ADPCM
+                    if (waveFmt.format == 2) decoder = new ADPCM(stream, waveFmt.channels, size, waveFmt.block);
+                    #endif
+                    break;
+                } else
+                    stream->seek(size);
+            }
+        } 
+        else if (fourcc == FOURCC("OggS")) { // ogg
+            stream->seek(-4);
+            #ifdef DECODE_OGG
+                decoder = new OGG(stream, 2);
+            #endif 
+        }
+        else if (fourcc == FOURCC("ID3\3")) { // mp3
+            #ifdef DECODE_MP3
+                decoder = new MP3(stream, 2);
+            #endif
+        }
+        else { // vag
+            stream->setPos(0);
+            #ifdef DECODE_VAG
+                decoder = new VAG(stream);
+            #endif
+        }
+
+        if (!decoder)
+            delete stream;
+
+        return decoder;
+    }
+
+// decoded samples (44100 Hz stereo frames) shared by channels, the mixer plays them without decoding
+    struct Buffer {
+        Frame   *frames;
+        int     count;
+        int     refs;       // cache and playing channels
+        int     key;
+        float   decodeTime; // ms, saved on every cache hit
+        Buffer  *prev, *next;
+
+        Buffer(int key) : frames(NULL), count(0), refs(1), key(key), decodeTime(0.0f), prev(NULL), next(NULL) {}
+        ~Buffer() { delete[] frames; }
+
+        int getSize() const { return count * sizeof(Frame); }
+
+        void release() { // under Sound::lock
+            if (!--refs) delete this;
+        }
+    };
+
+    struct Cached : Decoder {
+        Buffer  *buffer;
+        int     pos;
+
+        Cached(Buffer *buffer) : Decoder(NULL, 2), buffer(buffer), pos(0) {
+            buffer->refs++;
+        }
+
+        virtual ~Cached() {
+            buffer->release();
+        }
+
+        virtual int decode(Frame *frames, int count) {
+            count = min(count, buffer->count - pos);
+            memcpy(frames, buffer->frames + pos, count * sizeof(Frame));
+            pos += count;
+            return count;
+        }
+
+        virtual void replay() {
+            pos = 0;
+        }
+    };
+
+    struct Cache {
+        Buffer  *first, *last; // most & least recently used
+        int     size;
+
+        struct Stats {
+            int     hits, misses, evictions;
+            double  decodeTime, savedTime;
+
+            int getHitRate() const {
+                return (hits + misses) ? hits * 100 / (hits + misses) : 0;
+            }
+        } stats;
+
+        Cache() : first(NULL), last(NULL), size(0) {
+            memset(&stats, 0, sizeof(stats));
+        }
+
+        void unlink(Buffer *buffer) {
+            if (buffer->prev) buffer->prev->next = buffer->next; else first = buffer->next;
+            if (buffer->next) buffer->next->prev = buffer->prev; else last  = buffer->prev;
+            buffer->prev = buffer->next = NULL;
+        }
+
+        void link(Buffer *buffer) {
+            buffer->next = first;
+            if (first) first->prev = buffer; else last = buffer;
+            first = buffer;
+        }
+
+        Decoder* get(int key) {
+            OS_LOCK(lock);
+            for (Buffer *buffer = first; buffer; buffer = buffer->next)
+                if (buffer->key == key) {
+                    unlink(buffer);
+                    link(buffer);
+                    stats.hits++;
+                    stats.savedTime += buffer->decodeTime;
+                    return new Cached(buffer);
+                }
+            return NULL;
+        }
+
+        Decoder* add(int key, Stream *stream) {
+            if (!stream) return NULL;
+            Decoder *decoder = openDecoder(stream);
+            if (!decoder) return NULL;
+
+        // decode the whole sample (decoders may return a few frames more than requested)
+            double time = getPreciseTime();
+
+            Buffer *buffer = new Buffer(key);
+            int capacity = 4096;
+            buffer->frames = new Frame[capacity + 8];
+            while (1) {
+                if (capacity - buffer->count < 8) {
+                    Frame *frames = new Frame[capacity * 2 + 8];
+                    memcpy(frames, buffer->frames, buffer->count * sizeof(Frame));
+                    delete[] buffer->frames;
+                    buffer->frames = frames;
+                    capacity *= 2;
+                }
+                int res = decoder->decode(buffer->frames + buffer->count, capacity - buffer->count);
+                if (!res) break;
+                buffer->count += res;
+            }
+            delete decoder;
+
+            buffer->decodeTime = float(getPreciseTime() - time);
+
+            OS_LOCK(lock);
+            stats.misses++;
+            stats.decodeTime += buffer->decodeTime;
+
+            if (buffer->getSize() > SND_CACHE_SIZE) { // play once without caching
+                Cached *cached = new Cached(buffer);
+                buffer->release();
+                return cached;
+            }
+
+            size += buffer->getSize();
+            while (size > SND_CACHE_SIZE && last) {
+                Buffer *lru = last;
+                unlink(lru);
+                size -= lru->getSize();
+                lru->release(); // freed after the last playing channel
+                stats.evictions++;
+            }
+            link(buffer);
+
+            return new Cached(buffer);
+        }
+
+        void clear() {
+            OS_LOCK(lock);
+            while (first) {
+                Buffer *buffer = first;
+                unlink(buffer);
+                buffer->release();
+            }
+            size = 0;
+        }
+    } cache;
+
     struct Sample {
         Decoder *decoder;
         vec3    pos;
@@ -478,59 +688,7 @@ namespace Sound {
         bool    isPlaying;
         bool    stopAfterFade;
 
-        Sample(Stream *stream, const vec3 &pos, float volume, float pitch, int flags, int id) : decoder(NULL), pos(pos), volume(volume), volumeTarget(volume), volumeDelta(0.0f), pitch(pitch), flags(flags), id(id) {
-            uint32 fourcc; 
-            stream->read(fourcc);
-            if (fourcc == FOURCC("RIFF")) { // wav
-
-                struct {
-                    uint16  format;
-                    uint16  channels;
-                    uint32  samplesPerSec;
-                    uint32  bytesPerSec;
-                    uint16  block;
-                    uint16  sampleBits;
-                } waveFmt;
-
-                stream->seek(8);
-                while (stream->pos < stream->size) {
-                    uint32 type, size;
-                    stream->read(type);
-                    stream->read(size);
-                    if (type == FOURCC("fmt ")) {
-                        stream->raw(&waveFmt, sizeof(waveFmt));
-                        stream->seek(size - sizeof(waveFmt));
-                    } else if (type == FOURCC("data")) {
-                        if (waveFmt.format == 1) decoder = new PCM(stream, waveFmt.channels, waveFmt.samplesPerSec, size, waveFmt.sampleBits);
-                        #ifdef DECODE_ADPCM
-                        if (waveFmt.format == 2) decoder = new ADPCM(stream, waveFmt.channels, size, waveFmt.block);
-                        #endif
-                        break;
-                    } else
-                        stream->seek(size);
-                }
-            } 
-            else if (fourcc == FOURCC("OggS")) { // ogg
-                stream->seek(-4);
-                #ifdef DECODE_OGG
-                    decoder = new OGG(stream, 2);
-                #endif 
-            }
-            else if (fourcc == FOURCC("ID3\3")) { // mp3
-                #ifdef DECODE_MP3
-                    decoder = new MP3(stream, 2);
-                #endif
-            }
-            else { // vag
-                stream->setPos(0);
-                #ifdef DECODE_VAG
-                    decoder = new VAG(stream);
-                #endif
-            }
-
-            if (!decoder)
-                delete stream;
-
+        Sample(Decoder *decoder, const vec3 &pos, float volume, float pitch, int flags, int id) : decoder(decoder), pos(pos), volume(volume), volumeTarget(volume), volumeDelta(0.0f), pitch(pitch), flags(flags), id(id) {
             isPlaying = decoder != NULL;
         }
 
@@ -758,47 +916,67 @@ namespace Sound {
         return stream;
     }
 
-    Sample* play(Stream *stream, const vec3 &pos, float volume = 1.0f, float pitch = 0.0f, int flags = 0, int id = - 1) {
-        OS_LOCK(lock);
-
-        ASSERT(pitch >= 0.0f);
-        if (!stream) return NULL;
-        if (volume > 0.001f) {
-            vec3 listenerPos = getListener(pos).matrix.getPos();
-
-            if (!(flags & (FLIPPED | UNFLIPPED | MUSIC)) && (flags & PAN)) {
-                vec3 d = pos - listenerPos;
-                if (fabsf(d.x) > SND_FADEOFF_DIST || fabsf(d.y) > SND_FADEOFF_DIST || fabsf(d.z) > SND_FADEOFF_DIST) {
-                    delete stream;
-                    return NULL;
-                }
-            }
+// reject checks of play, returns true if the sound takes a new channel, otherwise channel is the playing one (UNIQUE, REPLAY) or NULL (dropped)
+    bool checkChannel(const vec3 &pos, float volume, float pitch, int flags, int id, Sample *&channel) {
+        channel = NULL;
+        if (volume <= 0.001f)
+            return false;
 
-            if (flags & (UNIQUE | REPLAY)) {
-                for (int i = 0; i < channelsCount; i++)
-                    if (channels[i]->id == id) {
-                        vec3 p = listenerPos;
+        vec3 listenerPos = getListener(pos).matrix.getPos();
 
-                        if ((p - channels[i]->pos).length2() > (p - pos).length2()) {
-                            channels[i]->pos = pos;
-                            channels[i]->pitch = pitch;
-                        }
+        if (!(flags & (FLIPPED | UNFLIPPED | MUSIC)) && (flags & PAN)) {
+            vec3 d = pos - listenerPos;
+            if (fabsf(d.x) > SND_FADEOFF_DIST || fabsf(d.y) > SND_FADEOFF_DIST || fabsf(d.z) > SND_FADEOFF_DIST)
+                return false;
+        }
 
-                        if (flags & REPLAY)
-                            channels[i]->replay();
+        if (flags & (UNIQUE | REPLAY)) {
+            for (int i = 0; i < channelsCount; i++)
+                if (channels[i]->id == id) {
+                    vec3 p = listenerPos;
 
-                        delete stream;
-                        return channels[i];
+                    if ((p - channels[i]->pos).length2() > (p - pos).length2()) {
+                        channels[i]->pos = pos;
+                        channels[i]->pitch = pitch;
                     }
-            }
 
-            if (channelsCount < SND_CHANNELS_MAX)
-                return channels[channelsCount++] = new Sample(stream, pos, volume, pitch, flags, id);
+                    if (flags & REPLAY)
+                        channels[i]->replay();
 
-            LOG("! no free channels\n");
+                    channel = channels[i];
+                    return false;
+                }
         }
-        delete stream;
-        return NULL;
+
+        if (channelsCount < SND_CHANNELS_MAX)
+            return true;
+
+        LOG("! no free channels\n");
+        return false;
+    }
+
+// check before the decoder is opened, so the dropped sounds don't pay for decoding
+    bool prepare(const vec3 &pos, float volume, float pitch, int flags, int id, Sample *&channel) {
+        OS_LOCK(lock);
+        return checkChannel(pos, volume, pitch, flags, id, channel);
+    }
+
+    Sample* play(Decoder *decoder, const vec3 &pos, float volume = 1.0f, float pitch = 0.0f, int flags = 0, int id = - 1) {
+        OS_LOCK(lock);
+
+        ASSERT(pitch >= 0.0f);
+        if (!decoder) return NULL;
+
+        Sample *channel;
+        if (checkChannel(pos, volume, pitch, flags, id, channel))
+            return channels[channelsCount++] = new Sample(decoder, pos, volume, pitch, flags, id);
+
+        delete decoder;
+        return channel;
+    }
+
+    Sample* play(Stream *stream, const vec3 &pos, float volume = 1.0f, float pitch = 0.0f, int flags = 0, int id = - 1) {
+        return stream ? play(openDecoder(stream), pos, volume, pitch, flags, id) : NULL;
     }
 
     void stop(int id = -1) {
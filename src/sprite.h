@@ -53,6 +53,14 @@ struct Sprite : Controller {
     }
 
     virtual void render(Frustum *frustum, MeshBuilder *mesh, Shader::Type type, bool caustics) {
+        if (frustum) { // camera facing quad fits into the box of its max extent
+            TR::SpriteSequence &seq = getSequence();
+            TR::SpriteTexture &sprite = level->spriteTextures[seq.sStart + frame % seq.sCount];
+            float r = float(max(max(abs(sprite.l), abs(sprite.r)), max(abs(sprite.t), abs(sprite.b))));
+            if (!frustum->isVisible(pos - vec3(r), pos + vec3(r)))
+                return;
+        }
+
         Basis b;
         b.w   = 1.0f;
         b.pos = pos;
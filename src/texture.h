@@ -70,6 +70,7 @@ struct Texture {
 
         void bind(uint16 tile, uint16 clut) {
         #ifdef _PSP
+            Core::stats.textures++;
             sceGuClutLoad(1, cluts + clut);
             sceGuTexImage(0, width, height, width, tiles + tile);
         #else
@@ -262,8 +263,10 @@ struct Texture {
 
     void bind(int sampler) {
     #ifdef _PSP
-        if (this && !sampler && memory)
+        if (this && !sampler && memory) {
+            Core::stats.textures++;
             sceGuTexImage(0, width, height, width, memory);
+        }
     #else
         #ifdef SPLIT_BY_TILE
             if (sampler || !ID) return;
@@ -271,6 +274,7 @@ struct Texture {
 
         if (Core::active.textures[sampler] != this) {
             Core::active.textures[sampler] = this;
+            Core::stats.textures++;
             glActiveTexture(GL_TEXTURE0 + sampler);
             glBindTexture((opt & CUBEMAP) ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, ID);
         }
@@ -912,6 +916,17 @@ struct Atlas {
     }
 
     Texture* pack() {
+        uint32 *data = build();
+        Texture *atlas = new Texture(width, height, Texture::RGBA, Texture::MIPMAPS, data);
+
+        //Texture::SaveBMP("atlas.bmp", (char*)data, width, height);
+
+        delete[] data;
+        return atlas;
+    }
+
+// pack tiles and fill the atlas pixels (width * height)
+    uint32* build() {
     // TODO TR2 fix CUT2 AV
 //        width  = 4096;//nextPow2(int(sqrtf(float(size))));
 //        height = 2048;//(width * width / 2 > size) ? (width / 2) : width;
@@ -958,13 +973,8 @@ struct Atlas {
         fill(root, data);
         fillInstances();
 
-        Texture *atlas = new Texture(width, height, Texture::RGBA, Texture::MIPMAPS, data);
-
-        //Texture::SaveBMP("atlas.bmp", (char*)data, width, height);
-
-        delete[] data;
-        return atlas;
-    };
+        return data;
+    }
 
     void fill(Node *node, void *data) {
         if (!node) return;
@@ -718,6 +718,10 @@ struct Crystal : Controller {
         getRoom().addDynLight(entity, vec4(lightPos, 0.0f), CRYSTAL_LIGHT_COLOR);
     }
 
+    virtual bool canInstance() const {
+        return false;
+    }
+
     virtual void render(Frustum *frustum, MeshBuilder *mesh, Shader::Type type, bool caustics) {
         Core::active.shader->setParam(uMaterial, vec4(0.5, 0.5, 3.0, 1.0f)); // blue color dodge for crystal
         environment->bind(sEnvironment);
@@ -960,9 +964,7 @@ struct ThorHammer : Controller {
         }
 
         updateAnimation(true);
-        block->animation.frameA = animation.frameA;
-        block->animation.frameB = animation.frameB;
-        block->animation.delta  = animation.delta;
+        block->animation.setFrames(animation);
     }
 };
 
@@ -1090,6 +1092,10 @@ struct Lightning : Controller {
     }
 
 
+    virtual bool canInstance() const {
+        return false;
+    }
+
     virtual void render(Frustum *frustum, MeshBuilder *mesh, Shader::Type type, bool caustics) {
         Controller::render(frustum, mesh, type, caustics);
         if (!flash) return;
@@ -4,6 +4,17 @@
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
+#include <stdint.h>
+#include <new>
+
+#ifdef PROFILE_LOAD
+    #include <atomic>
+#endif
+
+#if defined(LINUX) && !defined(NO_MMAP)
+    #define USE_MMAP
+    #include <sys/mman.h>
+#endif
 
 #ifdef _DEBUG
     #ifdef LINUX
@@ -72,6 +83,8 @@ typedef signed int      int32;
 typedef unsigned char   uint8;
 typedef unsigned short  uint16;
 typedef unsigned int    uint32;
+typedef signed long long   int64;
+typedef unsigned long long uint64;
 
 #define FOURCC(str)     uint32(((uint8*)(str))[0] | (((uint8*)(str))[1] << 8) | (((uint8*)(str))[2] << 16) | (((uint8*)(str))[3] << 24) )
 
@@ -185,27 +198,38 @@ uint32 fnv32(const char *data, int32 size, uint32 hash = 0x811c9dc5) {
 }
 
 template <class T>
-void qsort(T* v, int L, int R) {
+struct TypeCmp {
+    int operator () (const T &a, const T &b) const { return T::cmp(a, b); }
+};
+
+template <class T, class C>
+void qsort(T* v, int L, int R, const C &cmp) {
     int i = L;
     int j = R;
     const T m = v[(L + R) / 2];
 
     while (i <= j) {
-        while (T::cmp(v[i], m) < 0) i++;
-        while (T::cmp(m, v[j]) < 0) j--;
+        while (cmp(v[i], m) < 0) i++;
+        while (cmp(m, v[j]) < 0) j--;
 
         if (i <= j)
             swap(v[i++], v[j--]);
     }
 
-    if (L < j) qsort(v, L, j);
-    if (i < R) qsort(v, i, R);
+    if (L < j) qsort(v, L, j, cmp);
+    if (i < R) qsort(v, i, R, cmp);
+}
+
+// cmp is a functor for the orders that depend on data outside of the items (see MeshBuilder::build)
+template <class T, class C>
+void sort(T *items, int count, const C &cmp) {
+    if (count)
+        qsort(items, 0, count - 1, cmp);
 }
 
 template <class T>
 void sort(T *items, int count) {
-    if (count)
-        qsort(items, 0, count - 1);
+    sort(items, count, TypeCmp<T>());
 }
 
 struct vec2 {
@@ -1132,6 +1156,79 @@ struct Box {
 };
 
 
+// bump allocator for data with a common lifetime (level), released at once
+#define ARENA_MIN_BLOCK (64 * 1024)
+
+struct Arena {
+    struct Block {
+        Block *next;
+        int   size;
+        int   used;
+    } *blocks;
+
+    int allocs;    // allocations served
+    int capacity;  // bytes reserved in all blocks
+
+    Arena() : blocks(NULL), allocs(0), capacity(0) {}
+    ~Arena() { free(); }
+
+    void reserve(int size) {
+        size = max(size, ARENA_MIN_BLOCK);
+        Block *block = (Block*)new char[sizeof(Block) + size];
+        block->next = blocks;
+        block->size = size;
+        block->used = 0;
+        blocks = block;
+        capacity += size;
+    }
+
+    void* alloc(int size, int align) {
+        if (!size) return NULL;
+
+        char *ptr = NULL;
+        if (blocks) {
+            char *start = (char*)(blocks + 1);
+            ptr = (char*)((uintptr_t(start + blocks->used) + align - 1) & ~uintptr_t(align - 1));
+            if (ptr + size > start + blocks->size)
+                ptr = NULL;
+        }
+
+        if (!ptr) {
+            reserve(max(size + align, blocks ? blocks->size / 2 : 0));
+            ptr = (char*)((uintptr_t(blocks + 1) + align - 1) & ~uintptr_t(align - 1));
+        }
+
+        blocks->used = int(ptr + size - (char*)(blocks + 1));
+        allocs++;
+        return ptr;
+    }
+
+    template <typename T>
+    T* alloc(int count) {
+        T *ptr = (T*)alloc(count * sizeof(T), alignof(T));
+        for (int i = 0; i < count; i++)
+            new (ptr + i) T;
+        return ptr;
+    }
+
+    int getUsed() const {
+        int used = 0;
+        for (Block *block = blocks; block; block = block->next)
+            used += block->used;
+        return used;
+    }
+
+    void free() {
+        while (blocks) {
+            Block *next = blocks->next;
+            delete[] (char*)blocks;
+            blocks = next;
+        }
+        allocs = capacity = 0;
+    }
+};
+
+
 struct Stream {
     static char cacheDir[255];
     static char contentDir[255];
@@ -1144,12 +1241,32 @@ struct Stream {
     char        *data;
     char        *name;
     int         size, pos;
+    Arena       *arena;  // owner of arrays allocated by read
 
     enum Endian { eLittle, eBig } endian;
 
-    Stream(const void *data, int size) : callback(NULL), userData(NULL), f(NULL), data((char*)data), name(NULL), size(size), pos(0), endian(eLittle) {}
+#ifdef USE_MMAP
+    struct Map {
+        char *data;
+        int   size;
+
+        Map() : data(NULL), size(0) {}
+
+        void free() {
+            if (data) munmap(data, size);
+            data = NULL;
+            size = 0;
+        }
+
+        bool contains(const void *ptr) const {
+            return data && ptr >= data && ptr < data + size;
+        }
+    } map;
+#endif
+
+    Stream(const void *data, int size) : callback(NULL), userData(NULL), f(NULL), data((char*)data), name(NULL), size(size), pos(0), arena(NULL), endian(eLittle) {}
 
-    Stream(const char *name, Callback *callback = NULL, void *userData = NULL) : callback(callback), userData(userData), data(NULL), name(NULL), size(-1), pos(0), endian(eLittle) {
+    Stream(const char *name, Callback *callback = NULL, void *userData = NULL) : callback(callback), userData(userData), data(NULL), name(NULL), size(-1), pos(0), arena(NULL), endian(eLittle) {
         if (contentDir[0] && (!cacheDir[0] || !strstr(name, cacheDir))) {
             char path[255];
             path[0] = 0;
@@ -1182,6 +1299,18 @@ struct Stream {
             size = ftell(f);
             fseek(f, 0, SEEK_SET);
 
+        #ifdef USE_MMAP
+            if (size > 0) {
+                void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0); // copy-on-write for in-place patching of views
+                if (ptr != MAP_FAILED) {
+                    map.data = data = (char*)ptr;
+                    map.size = size;
+                    fclose(f);
+                    f = NULL;
+                }
+            }
+        #endif
+
             this->name = new char[strlen(name) + 1];
             strcpy(this->name, name);
 
@@ -1193,6 +1322,9 @@ struct Stream {
     ~Stream() {
         delete[] name;
         if (f) fclose(f);
+    #ifdef USE_MMAP
+        map.free();
+    #endif
     }
 
     static bool exists(const char *name) {
@@ -1226,6 +1358,23 @@ struct Stream {
         pos += offset;
     }
 
+    uint32 getHash() {
+        if (!f)
+            return fnv32(data, size);
+
+        int lastPos = pos;
+        setPos(0);
+        uint32 hash = 0x811c9dc5;
+        char buf[64 * 1024];
+        while (pos < size) {
+            int count = min(size - pos, int(sizeof(buf)));
+            raw(buf, count);
+            hash = fnv32(buf, count, hash);
+        }
+        setPos(lastPos);
+        return hash;
+    }
+
     void raw(void *data, int count) {
         if (!count) return;
         if (f)
@@ -1250,12 +1399,35 @@ struct Stream {
     template <typename T>
     inline T* read(T *&a, int count) {
         if (count) {
-            a = new T[count];
+            a = arena ? arena->alloc<T>(count) : new T[count];
             raw(a, count * sizeof(T));
         } else
             a = NULL;
         return a;
     }
+
+// returns pointer into the file mapping without copying (fallback to read if the stream isn't mapped or data is misaligned)
+// the mapping must be taken by the owner of views (see takeMap) before the stream is deleted
+    template <typename T>
+    inline T* view(T *&a, int count) {
+    #ifdef USE_MMAP
+        if (count && map.data && !(uintptr_t(data + pos) % alignof(T))) {
+            ASSERT(pos + count * int(sizeof(T)) <= size);
+            a = (T*)(data + pos);
+            pos += count * sizeof(T);
+            return a;
+        }
+    #endif
+        return read(a, count);
+    }
+
+#ifdef USE_MMAP
+    Map takeMap() {
+        Map m = map;
+        map = Map();
+        return m;
+    }
+#endif
 };
 
 
@@ -1312,4 +1484,178 @@ namespace String {
 
 }
 
+// monotonic time in ms with sub-ms precision (profiling & stats)
+#if !defined(WIN32) && !defined(__EMSCRIPTEN__) && !defined(_PSP)
+    #include <time.h>
+#endif
+
+double getPreciseTime() {
+#ifdef WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return double(count.QuadPart) * 1000.0 / double(freq.QuadPart);
+#elif __EMSCRIPTEN__
+    return emscripten_get_now();
+#elif _PSP
+    return double(osGetTime());
+#else
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+#endif
+}
+
+#ifdef PROFILE_LOAD
+// load phase profiler: wall time and heap allocations of nested LOAD_PHASE scopes per level
+
+    #ifdef _MSC_VER
+        #define THREAD_LOCAL __declspec(thread)
+        #define NO_INLINE    __declspec(noinline)
+    #else
+        #define THREAD_LOCAL __thread
+        #define NO_INLINE    __attribute__((noinline))
+    #endif
+
+    #define MAX_LOAD_PHASES 1024
+    #define MAX_LOAD_LEVELS 64
+
+    THREAD_LOCAL int64 allocBytes;  // per thread accumulators, a phase counts the allocations of its own thread only
+    THREAD_LOCAL int   allocCount;  // (not the other loading level or the job workers)
+
+// the array forms go through the scalar ones as the default operators do, none is inlined into the callers
+// so the compiler doesn't pair the operator new of a call site with the free of an inlined delete
+    NO_INLINE void* operator new(size_t size) {
+        allocBytes += size;
+        allocCount++;
+        return malloc(size ? size : 1);
+    }
+
+    NO_INLINE void operator delete(void *ptr) {
+        free(ptr);
+    }
+
+    NO_INLINE void* operator new[](size_t size) {
+        return operator new(size);
+    }
+
+    NO_INLINE void operator delete[](void *ptr) {
+        operator delete(ptr);
+    }
+
+    namespace LoadProfile {
+
+        struct Phase {
+            const char *name;
+            int         level;
+            int         depth;
+            double      time;
+            int64       bytes;
+            int         allocs;
+        } phases[MAX_LOAD_PHASES];
+
+        char    levels[MAX_LOAD_LEVELS][64];
+        std::atomic<int> phasesCount; // slots are reserved atomically, the loader and the main thread record phases concurrently
+        std::atomic<int> levelsCount;
+        THREAD_LOCAL int depth;
+
+    // phases of a level are recorded sequentially (loader thread, then main thread)
+        void begin(const char *name) {
+            int index = levelsCount++;
+            if (index >= MAX_LOAD_LEVELS) {
+                levelsCount--;
+                return;
+            }
+            const char *str = name ? name : "unknown";
+            const char *sep = strrchr(str, '/');
+            if (sep) str = sep + 1;
+            strncpy(levels[index], str, sizeof(levels[0]) - 1);
+            levels[index][sizeof(levels[0]) - 1] = 0;
+        }
+
+        struct Scope {
+            Phase  *phase;
+            double time;
+            int64  bytes;
+            int    allocs;
+
+            Scope(const char *name) : phase(NULL), time(0.0), bytes(0), allocs(0) {
+                if (!levelsCount) return;
+                int index = phasesCount++;
+                if (index >= MAX_LOAD_PHASES) {
+                    phasesCount--;
+                    return;
+                }
+                phase = &phases[index];
+                phase->name  = name;
+                phase->level = levelsCount - 1;
+                phase->depth = depth++;
+                time   = getPreciseTime();
+                bytes  = allocBytes;
+                allocs = allocCount;
+            }
+
+            ~Scope() {
+                if (!phase) return;
+                depth--;
+                phase->time   = getPreciseTime() - time;
+                phase->bytes  = allocBytes - bytes;
+                phase->allocs = allocCount - allocs;
+            }
+        };
+
+        void print() {
+            for (int i = 0; i < phasesCount; i++) {
+                Phase &p = phases[i];
+                if (p.level != levelsCount - 1) continue;
+                LOG("%-16s %*s%-*s %9.3f ms %10lld bytes %6d allocs\n", levels[p.level], p.depth * 2, "", 20 - p.depth * 2, p.name, p.time, p.bytes, p.allocs);
+            }
+        }
+
+    // {"levels":[{"name":"LEVEL1.PHD","phases":[{"name":"parse","depth":0,"ms":1.0,"bytes":0,"allocs":0},...]},...]}
+        void save(const char *fileName) {
+            int size = 64 + levelsCount * 96 + phasesCount * 128;
+            char *buf = (char*)malloc(size);
+            char *ptr = buf;
+
+            ptr += sprintf(ptr, "{\"levels\":[");
+            for (int j = 0; j < levelsCount; j++) {
+                ptr += sprintf(ptr, "%s\n  {\"name\":\"%s\",\"phases\":[", j ? "," : "", levels[j]);
+                bool first = true;
+                for (int i = 0; i < phasesCount; i++) {
+                    Phase &p = phases[i];
+                    if (p.level != j) continue;
+                    ptr += sprintf(ptr, "%s\n    {\"name\":\"%s\",\"depth\":%d,\"ms\":%.3f,\"bytes\":%lld,\"allocs\":%d}", first ? "" : ",", p.name, p.depth, p.time, p.bytes, p.allocs);
+                    first = false;
+                }
+                ptr += sprintf(ptr, "]}");
+            }
+            ptr += sprintf(ptr, "\n]}\n");
+
+            ASSERT(ptr - buf < size);
+            Stream::write(fileName, buf, int(ptr - buf));
+            free(buf);
+        }
+
+    // rewrite the report after each loaded level
+        void save() {
+            char fileName[255];
+            strcpy(fileName, Stream::cacheDir);
+            strcat(fileName, "load_profile.json");
+            save(fileName);
+            print();
+        }
+    }
+
+    #define LOAD_PHASE_NAME(line) _loadPhase##line
+    #define LOAD_PHASE_DECL(name, line) LoadProfile::Scope LOAD_PHASE_NAME(line)(name)
+    #define LOAD_PHASE(name)      LOAD_PHASE_DECL(name, __LINE__)
+    #define LOAD_PROFILE_BEGIN(name) LoadProfile::begin(name)
+    #define LOAD_PROFILE_SAVE()      LoadProfile::save()
+#else
+    #define LOAD_PHASE(name)
+    #define LOAD_PROFILE_BEGIN(name)
+    #define LOAD_PROFILE_SAVE()
+#endif
+
 #endif